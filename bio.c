@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -13,83 +13,365 @@
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 //
-// The implementation uses two state flags internally:
+// Asynchronous interface, for keeping many disk requests
+// in flight at once:
+// * bread_async and bwrite_async start a request and return
+//     without waiting for the disk.
+// * biowait waits for the request to complete; the buffer
+//     must not be used or released until it has.
+// * Alternatively, set b->iodone before starting the request;
+//     the driver calls it (from an interrupt) on completion.
+// * To read a block that will be needed soon, call bprefetch.
+//
+// The implementation uses three state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_ASYNC: an asynchronous request is in progress;
+//     the driver calls biodone when it completes.
+// * B_RDAHEAD: bprefetch is reading the block with the buffer
+//     unlocked; biodone drops bprefetch's reference, and bget
+//     waits for the read before returning the buffer.
+//
+// Buffers are hashed by (dev, blockno) into NBUCKET buckets,
+// each with its own lock, so lookups of different blocks
+// on different CPUs do not contend.  A cache miss recycles
+// an unused buffer chosen by a clock sweep over all buffers;
+// bcache.lock serializes recycling, which is the only operation
+// that moves a buffer from one bucket to another.
+//
+// Buffer data lives in pages from kalloc(), BPP buffers to a page.
+// The cache starts with NBUF buffers and, rather than evict a
+// cached block, grows a page at a time up to NBUFMAX buffers while
+// free memory lasts.  When free memory runs low, the log flusher
+// thread calls breclaim() to take back pages of idle buffers (not
+// from inside kalloc(), whose callers may hold any lock), but never
+// below NBUF, which covers the buffers the log can pin (a transaction's
+// dirty blocks plus those of a commit or recovery) with room to
+// spare.  If every buffer is in use anyway, bget grows the cache
+// regardless of free memory.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 
-struct {
+#define NBUCKET 13
+#define BHASH(dev, blockno) (((dev)*31 + (blockno)) % NBUCKET)
+#define BUCKET(b) (&bcache.bucket[BHASH((b)->dev, (b)->blockno)])
+
+#define BPP (PGSIZE/BSIZE)       // buffers per page of data
+#define NBUFPAGE (NBUFMAX/BPP)
+#define BMINFREE 256             // free pages the cache won't grow into
+#define BLOWFREE 64              // free pages below which breclaim shrinks it
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;  // hash chain, through prev/next
+  uint hits;        // lookups satisfied from this bucket
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;  // acquire before any bucket lock
+  struct buf buf[NBUFMAX];
+  char *page[NBUFPAGE];  // data for buf[i*BPP..(i+1)*BPP-1], or 0
+  struct bucket bucket[NBUCKET];
+  int nbuf;              // buffers with data pages
+  int hand;              // clock hand, index into buf[]
+  uint misses;           // lookups that recycled a buffer
+  uint evicts;           // recycled buffers that held a block
+  int crashwrites;       // disk writes left before bcrash() crashes, or -1
 } bcache;
 
+static int bgrow(void);
+static void bcrashcheck(void);
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  bcache.crashwrites = -1;
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+  for(b = bcache.buf; b < bcache.buf+NBUFMAX; b++)
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+
+  while(bcache.nbuf < NBUF)
+    if(!bgrow())
+      panic("binit");
+}
+
+// Insert b at the head of its hash bucket.
+// Caller must hold the bucket lock.
+static void
+bhash(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// Remove b from its hash bucket.
+// Caller must hold the bucket lock.
+static void
+bunhash(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Add a page of empty buffers to the cache.
+// They hold block 0 of device 0, which is never read,
+// and the clock hand points at them so bget uses them next.
+// Returns 0 if the cache is at its maximum size or
+// there is no memory.
+// Caller must hold bcache.lock.
+static int
+bgrow(void)
+{
+  struct buf *b;
+  struct bucket *bk;
+  char *mem;
+  int g;
+
+  for(g = 0; g < NBUFPAGE; g++)
+    if(bcache.page[g] == 0)
+      break;
+  if(g == NBUFPAGE)
+    return 0;
+  if((mem = kalloc()) == 0)
+    return 0;
+
+  bk = &bcache.bucket[BHASH(0, 0)];
+  acquire(&bk->lock);
+  for(b = &bcache.buf[g*BPP]; b < &bcache.buf[(g+1)*BPP]; b++){
+    b->dev = 0;
+    b->blockno = 0;
+    b->flags = 0;
+    b->refcnt = 0;
+    b->used = 0;
+    b->iodone = 0;
+    b->data = (uchar*)mem + (b - &bcache.buf[g*BPP])*BSIZE;
+    bhash(bk, b);
   }
+  release(&bk->lock);
+
+  bcache.page[g] = mem;
+  bcache.nbuf += BPP;
+  bcache.hand = g*BPP;
+  return 1;
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
-static struct buf*
-bget(uint dev, uint blockno)
+// Give a page of idle buffers back to kalloc().
+// Returns 1 if a page was freed.
+static int
+bshrink(void)
 {
   struct buf *b;
+  struct bucket *bk;
+  int g, i;
 
   acquire(&bcache.lock);
+  for(g = NBUFPAGE-1; g >= 0 && bcache.nbuf - BPP >= NBUF; g--){
+    if(bcache.page[g] == 0)
+      continue;
 
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+    // Unhash the page's buffers so that bget can't find them,
+    // backing out if one of them is in use.
+    for(i = 0; i < BPP; i++){
+      b = &bcache.buf[g*BPP + i];
+      bk = BUCKET(b);
+      acquire(&bk->lock);
+      if(b->refcnt != 0 || (b->flags & B_DIRTY)){
+        release(&bk->lock);
+        break;
+      }
+      bunhash(b);
+      release(&bk->lock);
+    }
+    if(i < BPP){
+      while(--i >= 0){
+        b = &bcache.buf[g*BPP + i];
+        bk = BUCKET(b);
+        acquire(&bk->lock);
+        bhash(bk, b);
+        release(&bk->lock);
+      }
+      continue;
+    }
+
+    for(b = &bcache.buf[g*BPP]; b < &bcache.buf[(g+1)*BPP]; b++)
+      b->data = 0;
+    kfree(bcache.page[g]);
+    bcache.page[g] = 0;
+    bcache.nbuf -= BPP;
+    release(&bcache.lock);
+    return 1;
+  }
+  release(&bcache.lock);
+  return 0;
+}
+
+// Give pages of idle buffers back to kalloc() while free
+// memory is low.  Called by the log flusher every tick;
+// the caller must hold no locks.
+void
+breclaim(void)
+{
+  while(kfreepages() < BLOWFREE && bshrink())
+    ;
+}
+
+// Look for block on device dev in bucket bk.
+// If found, take a reference to it.
+// Caller must hold bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
+      b->used = 1;
+      bk->hits++;
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+// Choose an unused buffer to recycle, giving recently used
+// buffers a second chance.  Returns it with its bucket lock
+// held, or 0 if every buffer is in use.
+// Caller must hold bcache.lock.
+static struct buf*
+bvictim(void)
+{
+  struct buf *b;
+  struct bucket *bk;
+  int n;
+
+  for(n = 0; n < 2*bcache.nbuf; ){
+    if(bcache.page[bcache.hand/BPP] == 0){
+      bcache.hand = (bcache.hand/BPP + 1)*BPP % NBUFMAX;
+      continue;
     }
+    b = &bcache.buf[bcache.hand];
+    bcache.hand = (bcache.hand + 1) % NBUFMAX;
+    n++;
+
+    // Even if refcnt==0, B_DIRTY indicates a buffer is in use
+    // because log.c has modified it but not yet committed it.
+    bk = BUCKET(b);
+    acquire(&bk->lock);
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      if(b->used == 0)
+        return b;
+      b->used = 0;
+    }
+    release(&bk->lock);
   }
-  panic("bget: no buffers");
+  return 0;
+}
+
+// Lock cached buffer b, waiting for a read that bprefetch
+// started to finish.
+static void
+block(struct buf *b)
+{
+  acquiresleep(&b->lock);
+  if(b->flags & B_RDAHEAD)
+    biowait(b);
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  bk = &bcache.bucket[BHASH(dev, blockno)];
+
+  // Is the block already cached?
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    block(b);
+    return b;
+  }
+
+  // Not cached. Look again holding bcache.lock, since another
+  // CPU may have recycled a buffer for this block meanwhile.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    release(&bcache.lock);
+    block(b);
+    return b;
+  }
+
+  // Recycle an unused buffer.  If that would evict a
+  // cached block, try to grow the cache instead; if there
+  // is no unused buffer, grow into any memory there is.
+  b = bvictim();
+  if((b == 0 || ((b->flags & B_VALID) && kfreepages() >= BMINFREE)) &&
+     bcache.nbuf < NBUFMAX){
+    if(b)
+      release(&BUCKET(b)->lock);
+    bgrow();
+    b = bvictim();
+  }
+  if(b == 0)
+    panic("bget: no buffers");
+  if(b->flags & B_VALID)
+    bcache.evicts++;
+  bcache.misses++;
+  b->refcnt = 1;
+  bunhash(b);
+  release(&BUCKET(b)->lock);
+
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->used = 1;
+  acquire(&bk->lock);
+  bhash(bk, b);
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Pass b to the driver of its disk.  The file system disk
+// is on virtio if QEMU provides one, else on IDE.
+static void
+diskrw(struct buf *b)
+{
+  if(virtiodisk(b->dev))
+    virtiorw(b);
+  else
+    iderw(b);
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -100,45 +382,188 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if((b->flags & B_VALID) == 0) {
-    iderw(b);
+    diskrw(b);
+  }
+  return b;
+}
+
+// Return a locked buf for the indicated block, starting to
+// read it from disk if it is not cached.  Call biowait
+// before using the data.
+struct buf*
+bread_async(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if((b->flags & B_VALID) == 0){
+    b->flags |= B_ASYNC;
+    diskrw(b);
   }
   return b;
 }
 
+// Return a locked buf for the indicated block without
+// reading it from disk, for a caller that will overwrite
+// all of its contents.
+struct buf*
+bclaim(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Start writing b's contents to disk.  Must be locked.
+// Call biowait before changing or releasing b.
+void
+bwrite_async(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_async");
+  bcrashcheck();
+  b->flags |= B_DIRTY|B_ASYNC;
+  diskrw(b);
+}
+
+// Wait for an asynchronous request on b to complete.
+void
+biowait(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = BUCKET(b);
+  acquire(&bk->lock);
+  while(b->flags & B_ASYNC)
+    sleep(b, &bk->lock);
+  release(&bk->lock);
+}
+
+// Called by the disk driver when an asynchronous request
+// on b completes.
+void
+biodone(struct buf *b)
+{
+  struct bucket *bk;
+  void (*fn)(struct buf*);
+
+  bk = BUCKET(b);
+  acquire(&bk->lock);
+  if(b->flags & B_RDAHEAD){
+    b->flags &= ~B_RDAHEAD;
+    b->refcnt--;  // bprefetch's reference
+  }
+  b->flags &= ~B_ASYNC;
+  fn = b->iodone;
+  b->iodone = 0;
+  wakeup(b);
+  release(&bk->lock);
+
+  if(fn)
+    fn(b);
+}
+
+// Start reading the indicated block into the cache,
+// unless it is already there, without waiting for the disk.
+// The buffer is unlocked once the request has started and
+// stays B_RDAHEAD, holding a reference, until biodone.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+  struct bucket *bk;
+
+  bk = &bcache.bucket[BHASH(dev, blockno)];
+  acquire(&bk->lock);
+  for(b = bk->head.next; b != &bk->head; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      break;
+  release(&bk->lock);
+  if(b != &bk->head)
+    return;
+
+  b = bget(dev, blockno);
+  if(b->flags & B_VALID){
+    brelse(b);
+    return;
+  }
+  b->flags |= B_ASYNC|B_RDAHEAD;
+  diskrw(b);
+  releasesleep(&b->lock);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
+  bcrashcheck();
   b->flags |= B_DIRTY;
-  iderw(b);
+  diskrw(b);
 }
 
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// It stays in its hash bucket until recycled by bget.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = BUCKET(b);
+  acquire(&bk->lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  release(&bk->lock);
+}
+
+// Crash injection, to test recovery: after bcrash(n) the
+// disk completes n more writes, and the next one panics
+// instead of starting, as if the power had failed there.
+void
+bcrash(int n)
+{
+  acquire(&bcache.lock);
+  bcache.crashwrites = n;
+  release(&bcache.lock);
+}
+
+static void
+bcrashcheck(void)
+{
+  if(bcache.crashwrites < 0)
+    return;
+  acquire(&bcache.lock);
+  if(bcache.crashwrites == 0)
+    panic("bcrash");  // keep bcache.lock so no other CPU writes
+  if(bcache.crashwrites > 0)
+    bcache.crashwrites--;
+  release(&bcache.lock);
+}
+
+// Report buffer cache statistics.
+void
+bstat(struct iostat *st)
+{
+  struct bucket *bk;
+
+  st->bhits = 0;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    acquire(&bk->lock);
+    st->bhits += bk->hits;
+    release(&bk->lock);
   }
-  
+  acquire(&bcache.lock);
+  st->bmisses = bcache.misses;
+  st->bevicts = bcache.evicts;
+  st->nbuf = bcache.nbuf;
   release(&bcache.lock);
 }
 //PAGEBREAK!
 // Blank page.
-
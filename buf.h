@@ -4,11 +4,19 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  int used;          // clock reference bit
+  struct buf *prev;  // hash bucket list
   struct buf *next;
-  struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  struct buf *qnext; // disk queue, sorted
+  struct buf *qprev;
+  struct buf *fnext; // disk queue, in arrival order
+  struct buf *fprev;
+  uint qtime;        // ticks when queued
+  void (*iodone)(struct buf*);  // called when async request completes
+  uchar *data;       // BSIZE bytes in a kalloc() page
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_ASYNC 0x8  // no process is waiting in iderw for this buffer
+#define B_RDAHEAD 0x10  // being prefetched, with no process holding it
 
@@ -0,0 +1,143 @@
+// Crash-recovery test for the log; see crashrun.
+//   crashtest n      run a sequence of operations, crashing
+//                    the kernel after n disk writes
+//   crashtest check  after reboot, check that the operations
+//                    that survived are a prefix of the sequence
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+
+#define NCREATE  20          // files created and written
+#define NLINK    8           // of those, linked and unlinked
+#define FSIZE    (2*BSIZE)   // bytes written to each, in one write
+#define NOP      (2*NCREATE + 2*NLINK)
+
+char buf[FSIZE];
+
+char*
+fname(char *prefix, int i)
+{
+  static char name[2][4];
+  char *p;
+
+  p = name[prefix[1] == 'l'];
+  p[0] = prefix[0];
+  p[1] = prefix[1];
+  p[2] = 'a' + i;
+  p[3] = 0;
+  return p;
+}
+
+void
+run(int n)
+{
+  int i, fd;
+
+  if(crashafter(n) < 0){
+    printf(1, "crashtest: crashafter failed\n");
+    exit();
+  }
+  for(i = 0; i < NCREATE; i++){
+    if((fd = open(fname("ct", i), O_CREATE|O_RDWR)) < 0){
+      printf(1, "crashtest: create failed\n");
+      exit();
+    }
+    memset(buf, 'a' + i, FSIZE);
+    if(write(fd, buf, FSIZE) != FSIZE){
+      printf(1, "crashtest: write failed\n");
+      exit();
+    }
+    close(fd);
+    if(i == NCREATE/2)
+      sync();  // install some of it too
+  }
+  for(i = 0; i < NLINK; i++){
+    if(link(fname("ct", i), fname("cl", i)) < 0 || unlink(fname("ct", i)) < 0){
+      printf(1, "crashtest: link failed\n");
+      exit();
+    }
+  }
+  printf(1, "crashtest: no crash\n");
+}
+
+// Return -1 if the file is missing, 0 if it is empty,
+// 1 if it holds its data, and exit if it is anything else.
+int
+state(char *name, int i)
+{
+  struct stat st;
+  int fd, j;
+
+  if((fd = open(name, O_RDONLY)) < 0)
+    return -1;
+  if(fstat(fd, &st) < 0 || (st.size != 0 && st.size != FSIZE)){
+    printf(1, "crashtest: %s has size %d\n", name, st.size);
+    exit();
+  }
+  if(st.size == 0){
+    close(fd);
+    return 0;
+  }
+  if(read(fd, buf, FSIZE) != FSIZE){
+    printf(1, "crashtest: read %s failed\n", name);
+    exit();
+  }
+  close(fd);
+  for(j = 0; j < FSIZE; j++)
+    if(buf[j] != 'a' + i){
+      printf(1, "crashtest: %s has wrong data\n", name);
+      exit();
+    }
+  return 1;
+}
+
+void
+check(void)
+{
+  int done[NOP], i, ct, cl, n, fd;
+
+  for(i = 0; i < NCREATE; i++){
+    ct = state(fname("ct", i), i);
+    cl = i < NLINK ? state(fname("cl", i), i) : -1;
+    done[2*i] = ct >= 0 || cl >= 0;
+    done[2*i+1] = ct == 1 || cl == 1;
+    if(i < NLINK){
+      done[2*NCREATE + 2*i] = cl >= 0;
+      done[2*NCREATE + 2*i + 1] = cl >= 0 && ct < 0;
+    }
+  }
+  for(n = 0; n < NOP && done[n]; n++)
+    ;
+  for(i = n; i < NOP; i++)
+    if(done[i]){
+      printf(1, "crashtest: operation %d survived but %d did not\n", i, n);
+      exit();
+    }
+
+  // the file system must still work
+  if((fd = open("ctnew", O_CREATE|O_RDWR)) < 0 ||
+     write(fd, buf, FSIZE) != FSIZE){
+    printf(1, "crashtest: create after recovery failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("ctnew");
+  printf(1, "crashtest: ok, %d of %d operations\n", n, NOP);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc != 2){
+    printf(2, "usage: crashtest n | crashtest check\n");
+    exit();
+  }
+  if(strcmp(argv[1], "check") == 0)
+    check();
+  else
+    run(atoi(argv[1]));
+  exit();
+}
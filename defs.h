@@ -1,7 +1,12 @@
 struct buf;
 struct context;
 struct file;
+struct gdent;
 struct inode;
+struct ioq;
+struct iostat;
+struct iovec;
+struct pcidev;
 struct pipe;
 struct proc;
 struct rtcdate;
@@ -15,6 +20,15 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+struct buf*     bread_async(uint, uint);
+struct buf*     bclaim(uint, uint);
+void            bwrite_async(struct buf*);
+void            biowait(struct buf*);
+void            biodone(struct buf*);
+void            bprefetch(uint, uint);
+void            bstat(struct iostat*);
+void            bcrash(int);
+void            breclaim(void);
 
 // console.c
 void            consoleinit(void);
@@ -33,12 +47,29 @@ void            fileinit(void);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filepread(struct file*, char*, int n, uint off);
+int             filepwrite(struct file*, char*, int n, uint off);
+int             fileseek(struct file*, int, int);
+int             filereadv(struct file*, struct iovec*, int);
+int             filewritev(struct file*, struct iovec*, int);
+int             filegetdents(struct file*, struct gdent*, int, int);
+void            filelimits(void);
+int             writeinode(struct inode*, struct iovec*, int, uint*);
+int             fdalloc(struct file*);
+void            fdfree(struct proc*, int);
+int             fdcopy(struct proc*, struct proc*);
+void            fdcloseall(struct proc*);
+void            fdinit(struct proc*);
 
 // fs.c
+extern struct superblock sb;
 void            readsb(int dev, struct superblock *sb);
+void            dcenter(struct inode*, char*, uint);
 int             dirlink(struct inode*, char*, uint);
+void            fsstat(struct iostat*);
 struct inode*   dirlookup(struct inode*, char*, uint*);
-struct inode*   ialloc(uint, short);
+int             dirread(struct inode*, uint*, struct gdent*, int, int);
+struct inode*   ialloc(uint, short, uint);
 struct inode*   idup(struct inode*);
 void            iinit(int dev);
 void            ilock(struct inode*);
@@ -57,15 +88,24 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idestat(struct iostat*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
+void            ioapicenablepci(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
 
+// iosched.c
+void            ioqinsert(struct ioq*, struct buf*);
+struct buf*     ioqnext(struct ioq*, struct buf*);
+void            ioqdone(struct ioq*, struct buf*);
+void            ioqstat(struct ioq*, struct iostat*);
+
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+int             kfreepages(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
 
@@ -84,8 +124,12 @@ void            microdelay(int);
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
-void            begin_op();
+void            begin_op(int);
 void            end_op();
+void            log_force(void);
+int             log_maxop(void);
+void            log_sync(void);
+void            logstat(struct iostat*);
 
 // mp.c
 extern int      ismp;
@@ -95,11 +139,31 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pci.c
+void            pciinit(void);
+struct pcidev*  pcifind(int, int, int, int);
+uint            pciread(struct pcidev*, int);
+void            pciwrite(struct pcidev*, int, uint);
+
+// mmap.c
+int             mmap(uint, int, int, struct file*, uint);
+int             munmap(uint, uint);
+uint            mmapbase(struct proc*);
+int             mmapcheck(uint, uint, int);
+void            mmapexit(struct proc*);
+int             mmapfault(uint, int);
+int             mmapfork(struct proc*, struct proc*);
+void            mmapinit(void);
+void            mmapread(struct inode*, char*, uint, uint);
+void            mmapwrite(struct inode*, char*, uint, uint);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipereadv(struct pipe*, struct iovec*, int);
+int             pipewritev(struct pipe*, struct iovec*, int);
 
 //PAGEBREAK: 16
 // proc.c
@@ -108,6 +172,7 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+int             kthread(char*, void(*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -151,6 +216,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argptr_ro(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -170,6 +236,13 @@ void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// virtio.c
+void            virtioinit(void);
+int             virtiodisk(uint);
+int             virtiointr(int);
+void            virtiorw(struct buf*);
+void            virtiostat(struct iostat*);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
@@ -185,6 +258,8 @@ void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+pte_t*          walkpgdir(pde_t*, const void*, int);
+int             mappages(pde_t*, void*, uint, uint, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
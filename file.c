@@ -5,39 +5,117 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "stat.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
+#include "uio.h"
 
 struct devsw devsw[NDEV];
+
+// File structures come from kalloc() a page at a time and
+// are kept on a free list when closed.  At most maxfile are
+// open at once, and each process may have at most maxofile
+// descriptors; both can be set at boot by filelimits().
+#define FPP (PGSIZE / sizeof(struct file))  // files per page
+
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct file *free;  // unused files, linked by next
+  int nopen;          // files in use
 } ftable;
 
+int maxfile = NFILE;
+int maxofile = NOFILEMAX;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
 }
 
+// Return the decimal number at s, or -1.
+static int
+limitarg(char *s)
+{
+  int n;
+
+  if(*s < '0' || *s > '9')
+    return -1;
+  for(n = 0; *s >= '0' && *s <= '9'; s++)
+    n = n*10 + *s - '0';
+  return n;
+}
+
+// Set the limits on open files from the file /limits, if
+// there is one.  Each of its lines is "nfile n", the most files
+// open in the system, or "nofile n", the most per process.
+// Called once at boot, by the first process.
+void
+filelimits(void)
+{
+  struct inode *ip;
+  char buf[128], *p;
+  int n;
+
+  begin_op(IPUTBLOCKS);
+  if((ip = namei("/limits")) == 0){
+    end_op();
+    return;
+  }
+  ilock(ip);
+  n = readi(ip, buf, 0, sizeof(buf) - 1);
+  iunlockput(ip);
+  end_op();
+  if(n < 0)
+    return;
+  buf[n] = 0;
+
+  for(p = buf; *p; ){
+    if(strncmp(p, "nfile ", 6) == 0 && (n = limitarg(p + 6)) > 0)
+      maxfile = n;
+    else if(strncmp(p, "nofile ", 7) == 0 && (n = limitarg(p + 7)) > 0)
+      maxofile = n < NOFILEMAX ? n : NOFILEMAX;
+    while(*p && *p++ != '\n')
+      ;
+  }
+}
+
 // Allocate a file structure.
 struct file*
 filealloc(void)
 {
   struct file *f;
+  char *mem;
+  int i;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
+  if(ftable.nopen >= maxfile){
+    release(&ftable.lock);
+    return 0;
+  }
+  if(ftable.free == 0){
+    if((mem = kalloc()) == 0){
       release(&ftable.lock);
-      return f;
+      return 0;
+    }
+    memset(mem, 0, PGSIZE);
+    for(i = 0; i < FPP; i++){
+      f = (struct file*)mem + i;
+      f->next = ftable.free;
+      ftable.free = f;
     }
   }
+  f = ftable.free;
+  ftable.free = f->next;
+  ftable.nopen++;
+  f->ref = 1;
   release(&ftable.lock);
-  return 0;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -68,12 +146,15 @@ fileclose(struct file *f)
   ff = *f;
   f->ref = 0;
   f->type = FD_NONE;
+  f->next = ftable.free;
+  ftable.free = f;
+  ftable.nopen--;
   release(&ftable.lock);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
   else if(ff.type == FD_INODE){
-    begin_op();
+    begin_op(IPUTBLOCKS);
     iput(ff.ip);
     end_op();
   }
@@ -92,22 +173,120 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Read entries from directory f.
+int
+filegetdents(struct file *f, struct gdent *ents, int n, int flags)
+{
+  int r;
+
+  if(f->type != FD_INODE || f->readable == 0)
+    return -1;
+  ilock(f->ip);
+  if(f->ip->type != T_DIR){
+    iunlock(f->ip);
+    return -1;
+  }
+  r = dirread(f->ip, &f->off, ents, n, flags & GD_STAT);
+  iunlock(f->ip);
+  return r;
+}
+
+// Read into the cnt buffers in iov from inode ip at *off,
+// and advance *off.
+static int
+readinode(struct inode *ip, struct iovec *iov, int cnt, uint *off)
+{
+  int j, r, n;
+
+  n = 0;
+  ilock(ip);
+  for(j = 0; j < cnt; j++){
+    if((r = readi(ip, iov[j].base, *off, iov[j].len)) < 0){
+      if(n == 0)
+        n = -1;
+      break;
+    }
+    *off += r;
+    n += r;
+    if(r < iov[j].len)
+      break;
+  }
+  iunlock(ip);
+  return n;
+}
+
+// Write the cnt buffers in iov to inode ip at *off, and
+// advance *off.  A vector that fits in one log operation is
+// written in one transaction.
+int
+writeinode(struct inode *ip, struct iovec *iov, int cnt, uint *off)
+{
+  int j, r, n, done, m, segoff;
+
+  n = 0;
+  for(j = 0; j < cnt; j++)
+    n += iov[j].len;
+
+  // write many blocks at a time, but not more than
+  // one operation may reserve in the log, including
+  // i-node, two indirect blocks and the double-indirect
+  // block, and 2 blocks of slop for non-aligned writes
+  // (begin_op() adds the allocation blocks).  this really
+  // belongs lower down, since writei() might be writing a
+  // device like the console.
+  int max = (log_maxop()-1-3-2) * BSIZE;
+  int i = 0;
+  j = segoff = 0;
+  while(i < n){
+    int n1 = n - i;
+    if(n1 > max)
+      n1 = max;
+
+    // The buffers are consecutive in the file, so n1 bytes
+    // of them touch no more blocks than one n1-byte write.
+    begin_op(n1/BSIZE + 1 + 3 + 2);
+    ilock(ip);
+    for(done = 0; done < n1; ){
+      if(segoff == iov[j].len){
+        j++;
+        segoff = 0;
+        continue;
+      }
+      m = iov[j].len - segoff;
+      if(m > n1 - done)
+        m = n1 - done;
+      if ((r = writei(ip, (char*)iov[j].base + segoff, *off, m)) > 0){
+        *off += r;
+        done += r;
+        segoff += r;
+      }
+      if(r != m)
+        break;  // error or out of extents
+    }
+    iunlock(ip);
+    end_op();
+
+    i += done;
+    if(done != n1)
+      break;
+  }
+  return i == n ? n : -1;
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
 {
-  int r;
+  struct iovec iov;
 
   if(f->readable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
-    return r;
+    iov.base = addr;
+    iov.len = n;
+    return readinode(f->ip, &iov, 1, &f->off);
   }
   panic("fileread");
 }
@@ -117,41 +296,204 @@ fileread(struct file *f, char *addr, int n)
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
+  struct iovec iov;
 
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
   if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
-
-      if(r < 0)
-        break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
-    }
-    return i == n ? n : -1;
+    iov.base = addr;
+    iov.len = n;
+    return writeinode(f->ip, &iov, 1, &f->off);
   }
   panic("filewrite");
 }
 
+// Read into the cnt buffers in iov from file f.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_PIPE)
+    return pipereadv(f->pipe, iov, cnt);
+  if(f->type == FD_INODE)
+    return readinode(f->ip, iov, cnt, &f->off);
+  panic("filereadv");
+}
+
+// Write the cnt buffers in iov to file f.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  if(f->writable == 0)
+    return -1;
+  if(f->type == FD_PIPE)
+    return pipewritev(f->pipe, iov, cnt);
+  if(f->type == FD_INODE)
+    return writeinode(f->ip, iov, cnt, &f->off);
+  panic("filewritev");
+}
+
+// Read from file f at offset off, leaving f's offset alone.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  iov.base = addr;
+  iov.len = n;
+  return readinode(f->ip, &iov, 1, &off);
+}
+
+// Write to file f at offset off, leaving f's offset alone.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+  struct iovec iov;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  iov.base = addr;
+  iov.len = n;
+  return writeinode(f->ip, &iov, 1, &off);
+}
+
+// Set the offset of file f to off, relative to the start,
+// the current offset or the end as whence says.
+// Return the new offset.
+int
+fileseek(struct file *f, int off, int whence)
+{
+  int base;
+
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  if(whence == SEEK_SET)
+    base = 0;
+  else if(whence == SEEK_CUR)
+    base = f->off;
+  else if(whence == SEEK_END)
+    base = f->ip->size;
+  else
+    base = -1;
+  if(base < 0 || base + off < 0){
+    iunlock(f->ip);
+    return -1;
+  }
+  f->off = base + off;
+  iunlock(f->ip);
+  return f->off;
+}
+
+// A process's descriptor table starts as the NOFILE entries
+// in its proc structure and moves to a page of NOFILEMAX
+// entries when it needs more.  The bitmaps fdused and fdfull
+// find the lowest free descriptor without scanning the table.
+
+// Set up p's empty descriptor table.
+void
+fdinit(struct proc *p)
+{
+  memset(p->ofile0, 0, sizeof(p->ofile0));
+  memset(p->fdused, 0, sizeof(p->fdused));
+  p->ofile = p->ofile0;
+  p->nofile = NOFILE;
+  p->fdfull = 0;
+}
+
+// Move p's descriptor table to a page.
+static int
+fdgrow(struct proc *p)
+{
+  struct file **t;
+
+  if((t = (struct file**)kalloc()) == 0)
+    return -1;
+  memset(t, 0, PGSIZE);
+  memmove(t, p->ofile, p->nofile * sizeof(t[0]));
+  p->ofile = t;
+  p->nofile = NOFILEMAX;
+  return 0;
+}
+
+static void
+fdset(struct proc *p, int fd, struct file *f)
+{
+  int w;
+
+  w = fd / 32;
+  p->ofile[fd] = f;
+  p->fdused[w] |= 1 << (fd % 32);
+  if(p->fdused[w] == ~0)
+    p->fdfull |= 1 << w;
+}
+
+// Allocate the lowest free file descriptor for the given file.
+// Takes over file reference from caller on success.
+int
+fdalloc(struct file *f)
+{
+  struct proc *curproc = myproc();
+  int w, fd;
+
+  if(curproc->fdfull == ~0)
+    return -1;
+  w = __builtin_ctz(~curproc->fdfull);
+  fd = w*32 + __builtin_ctz(~curproc->fdused[w]);
+  if(fd >= maxofile)
+    return -1;
+  if(fd >= curproc->nofile && fdgrow(curproc) < 0)
+    return -1;
+  fdset(curproc, fd, f);
+  return fd;
+}
+
+// Clear descriptor fd of p, without closing its file.
+void
+fdfree(struct proc *p, int fd)
+{
+  p->ofile[fd] = 0;
+  p->fdused[fd / 32] &= ~(1 << (fd % 32));
+  p->fdfull &= ~(1 << (fd / 32));
+}
+
+// Give np, a new process, copies of p's descriptors.
+int
+fdcopy(struct proc *np, struct proc *p)
+{
+  int w, fd;
+  uint m;
+
+  if(p->nofile > np->nofile && fdgrow(np) < 0)
+    return -1;
+  for(w = 0; w < NOFILEMAX/32; w++){
+    for(m = p->fdused[w]; m; m &= m - 1){
+      fd = w*32 + __builtin_ctz(m);
+      fdset(np, fd, filedup(p->ofile[fd]));
+    }
+  }
+  return 0;
+}
+
+// Close all of p's descriptors and free its table.
+void
+fdcloseall(struct proc *p)
+{
+  int w, fd;
+  uint m;
+
+  for(w = 0; w < NOFILEMAX/32; w++){
+    for(m = p->fdused[w]; m; m &= m - 1){
+      fd = w*32 + __builtin_ctz(m);
+      fileclose(p->ofile[fd]);
+    }
+  }
+  if(p->ofile != p->ofile0)
+    kfree((char*)p->ofile);
+  fdinit(p);
+}
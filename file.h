@@ -1,6 +1,7 @@
 struct file {
   enum { FD_NONE, FD_PIPE, FD_INODE } type;
   int ref; // reference count
+  struct file *next; // ftable free list
   char readable;
   char writable;
   struct pipe *pipe;
@@ -9,20 +10,37 @@ struct file {
 };
 
 
+#define BMCACHE 16  // block addresses cached in each inode by bmap
+
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // icache hash chain
+  struct inode *lprev; // icache LRU list, while ref is 0
+  struct inode *lnext;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint ralast;        // last block of previous read
+  uint rawin;         // read-ahead window (blocks); 0 if not sequential
+  uint raend;         // blocks before this have been read ahead
+  uint bmbn;          // first file block in bmaddr
+  uint bmaddr[BMCACHE]; // addresses from an indirect block; 0 if unknown
+  uint balast;        // last block allocated to the inode, or 0
+  int nmpage;         // pages of the inode cached by mmap.c
+  int dcdir;          // a directory with dcache entries; namex reads it unlocked
 
   short type;         // copy of disk inode
+  short flags;        // I_EXTENT
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  union {
+    uint addrs[NDIRECT+2];
+    char data[NINLINE];
+  };
 };
 
 // table mapping major device number to
@@ -20,9 +20,19 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "x86.h"
+#include "iostat.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define RAMIN   4   // initial read-ahead window, in blocks
+#define RAMAX  32   // maximum read-ahead window, in blocks
 static void itrunc(struct inode*);
+static void imapinit(int);
+static void istat(struct iostat*);
+static void dcinit(void);
+static void dcstat(struct iostat*);
+static void dcpurge(struct inode*);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -51,30 +61,214 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// The free bitmap is summarized in memory by the number of free
+// blocks in each bitmap block, counted at mount time, so that
+// allocation skips full bitmap blocks without reading them.
+// Within a bitmap block, the search tests a word of 32 bits
+// at a time.  The search starts at a goal block chosen by the
+// caller, such as the block after the one it allocated last,
+// or else where the previous allocation left off (next fit).
+// The counts are updated while holding the bitmap block, whose
+// buf lock serializes changes to it.
+
+#define MAXBMAP (FSSIZE/BPB + 1)  // bitmap blocks the summary can track
+
+struct {
+  struct spinlock lock;
+  int nfree[MAXBMAP];  // free blocks in each bitmap block
+  uint total;          // free blocks in all
+  uint cursor;         // block after the last one allocated
+  uint nalloc;         // statistics
+  uint nscan;
+  uint cycles;
+} bsum;
+
+static int
+popcount(uint x)
+{
+  int n;
+
+  for(n = 0; x; n++)
+    x &= x - 1;
+  return n;
+}
+
+// Bits of bitmap block g that describe blocks of the disk.
+static int
+bmlimit(int g)
+{
+  return min(BPB, sb.size - g*BPB);
+}
+
+// Count the free blocks described by each bitmap block.
+static void
+bsuminit(int dev)
+{
+  struct buf *bp;
+  uint *w;
+  int g, i, limit, n;
+
+  initlock(&bsum.lock, "bsum");
+  if((sb.size + BPB - 1) / BPB > MAXBMAP)
+    panic("bsuminit: disk too big");
+  for(g = 0; g*BPB < sb.size; g++){
+    bp = bread(dev, sb.bmapstart + g);
+    w = (uint*)bp->data;
+    limit = bmlimit(g);
+    n = 0;
+    for(i = 0; i < limit; i += 32){
+      if(limit - i >= 32)
+        n += 32 - popcount(w[i/32]);
+      else
+        n += (limit - i) - popcount(w[i/32] & ((1 << (limit - i)) - 1));
+    }
+    bsum.nfree[g] = n;
+    bsum.total += n;
+    brelse(bp);
+  }
+}
+
+// Record that bit bi of the bitmap block in bp, for block b,
+// changed to used (d = -1) or free (d = 1).
+static void
+bsumadd(struct buf *bp, int bi, uint b, int d)
+{
+  bp->data[bi/8] ^= 1 << (bi % 8);
+  log_write(bp);
+  acquire(&bsum.lock);
+  bsum.nfree[b / BPB] += d;
+  bsum.total += d;
+  if(d < 0){
+    bsum.cursor = b + 1;
+    bsum.nalloc++;
+  }
+  release(&bsum.lock);
+}
+
+// Return the first clear bit at or after bit start of the
+// bitmap data, below limit, or -1 if there is none.
+static int
+bmfind(uchar *data, int start, int limit)
+{
+  uint *w, x;
+  int i, b;
+
+  w = (uint*)data;
+  for(i = start/32; i*32 < limit; i++){
+    x = ~w[i];
+    if(i == start/32)
+      x &= ~0U << (start % 32);
+    if(x){
+      b = i*32 + __builtin_ctz(x);
+      return b < limit ? b : -1;
+    }
+  }
+  return -1;
+}
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block, at or after goal if possible.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  int g, i, ng, bi, nread;
+  uint t0, b;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
+  t0 = rdtsc();
+  nread = 0;
+  if(goal == 0 || goal >= sb.size)
+    goal = bsum.cursor % sb.size;
+  ng = (sb.size + BPB - 1) / BPB;
+  g = goal / BPB;
+  // Visit goal's bitmap block twice: last time for
+  // the bits before goal.
+  for(i = 0; i <= ng; i++, g = (g + 1) % ng){
+    if(bsum.nfree[g] == 0)
+      continue;
+    bp = bread(dev, sb.bmapstart + g);
+    nread++;
+    bi = bmfind(bp->data, i == 0 ? goal % BPB : 0, bmlimit(g));
+    if(bi < 0){
+      brelse(bp);
+      continue;
+    }
+    b = g*BPB + bi;
+    bsumadd(bp, bi, b, -1);
+    brelse(bp);
+    bzero(dev, b);
+    acquire(&bsum.lock);
+    bsum.nscan += nread;
+    bsum.cycles += rdtsc() - t0;
+    release(&bsum.lock);
+    return b;
+  }
+  panic("balloc: out of blocks");
+}
+
+// Allocate block b, zeroed, if it is free.
+// Return b, or 0 if it is in use or past the end of the disk.
+static uint
+ballocat(uint dev, uint b)
+{
+  struct buf *bp;
+  int bi;
+
+  if(b >= sb.size || bsum.nfree[b / BPB] == 0)
+    return 0;
+  bp = bread(dev, BBLOCK(b, sb));
+  bi = b % BPB;
+  if(bp->data[bi/8] & (1 << (bi % 8))){
+    brelse(bp);
+    return 0;
+  }
+  bsumadd(bp, bi, b, -1);
+  brelse(bp);
+  bzero(dev, b);
+  return b;
+}
+
+// Allocate the first block of a run of n free blocks, so that
+// an extent starting there has room to grow, searching from
+// goal's bitmap block.  If there is no such run, allocate any
+// free block.
+static uint
+ballocrun(uint dev, uint goal, int n)
+{
+  int g, i, ng, bi, limit, run;
+  uint *w;
+  struct buf *bp;
+
+  ng = (sb.size + BPB - 1) / BPB;
+  g = goal < sb.size ? goal / BPB : 0;
+  for(i = 0; i < ng; i++, g = (g + 1) % ng){
+    if(bsum.nfree[g] < n)
+      continue;
+    bp = bread(dev, sb.bmapstart + g);
+    w = (uint*)bp->data;
+    limit = bmlimit(g);
+    run = 0;
+    for(bi = 0; bi < limit; bi++){
+      if(bi % 32 == 0 && w[bi/32] == ~0U){
+        run = 0;
+        bi += 31;
+        continue;
+      }
+      if(bp->data[bi/8] & (1 << (bi % 8))){
+        run = 0;
+        continue;
+      }
+      if(++run == n){
+        bi -= n - 1;
+        bsumadd(bp, bi, g*BPB + bi, -1);
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        bzero(dev, g*BPB + bi);
+        return g*BPB + bi;
       }
     }
     brelse(bp);
   }
-  panic("balloc: out of blocks");
+  return balloc(dev, goal);
 }
 
 // Free a disk block.
@@ -89,11 +283,46 @@ bfree(int dev, uint b)
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
-  bp->data[bi/8] &= ~m;
-  log_write(bp);
+  bsumadd(bp, bi, b, 1);
   brelse(bp);
 }
 
+// Where to put the first block of inode ip: the data area is
+// divided among the inode blocks, so that files whose inodes
+// are near each other get blocks near each other too.
+static uint
+bgoal(struct inode *ip)
+{
+  uint data, ngroup;
+
+  data = sb.bmapstart + (sb.size + BPB - 1) / BPB;
+  ngroup = sb.ninodes / IPB + 1;
+  return data + (ip->inum / IPB) * ((sb.size - data) / ngroup);
+}
+
+// Allocate a block for inode ip, after the last one it got.
+static uint
+ballocip(struct inode *ip)
+{
+  ip->balast = balloc(ip->dev, ip->balast ? ip->balast + 1 : bgoal(ip));
+  return ip->balast;
+}
+
+// Report allocation statistics.
+void
+fsstat(struct iostat *st)
+{
+  acquire(&bsum.lock);
+  st->nalloc = bsum.nalloc;
+  st->ascan = bsum.nscan;
+  st->acycles = bsum.cycles;
+  st->freeblocks = bsum.total;
+  st->fsblocks = sb.size;
+  release(&bsum.lock);
+  istat(st);
+  dcstat(st);
+}
+
 // Inodes.
 //
 // An inode describes a single unnamed file.
@@ -111,13 +340,22 @@ bfree(int dev, uint b)
 // inodes include book-keeping information that is
 // not stored on disk: ip->ref and ip->valid.
 //
+// Cached inodes are hashed by (dev, inum).  An entry whose
+// ref falls to zero stays valid on an LRU list, so that a later
+// iget finds it and ilock need not read the inode block again;
+// iget recycles the least recently used such entry.  Entries
+// come from kalloc() a page at a time: the cache grows while it
+// holds fewer than NINODE entries or all of them are in use,
+// up to NINODEMAX.
+//
 // An inode and its in-memory representation go through a
 // sequence of states before they can be used by the
 // rest of the file system code.
 //
 // * Allocation: an inode is allocated if its type (on disk)
-//   is non-zero. ialloc() allocates, and iput() frees if
-//   the reference and link counts have fallen to zero.
+//   is non-zero, which imap mirrors in memory. ialloc()
+//   allocates, and iput() frees if the reference and link
+//   counts have fallen to zero.
 //
 // * Referencing in cache: an entry in the inode cache
 //   is free if ip->ref is zero. Otherwise ip->ref tracks
@@ -130,7 +368,7 @@ bfree(int dev, uint b)
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid if it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -155,62 +393,179 @@ bfree(int dev, uint b)
 // multi-step atomic operations.
 //
 // The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// entries, the hash chains and the LRU list. Since ip->ref
+// indicates whether an entry is free, and ip->dev and ip->inum
+// indicate which i-node an entry holds, one must hold
+// icache.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev)*31 + (inum)) % NIHASH)
+#define IPP (PGSIZE / sizeof(struct inode))  // inodes per page
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];  // chains through hnext
+  struct inode *lru;           // unreferenced entries, least recent first
+  struct inode *lrutail;
+  int n;                       // entries allocated
+  uint hits;                   // igets that found the inode cached
+  uint misses;                 // igets that recycled an entry
 } icache;
 
 void
 iinit(int dev)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
- inodestart %d bmap start %d\n", sb.size, sb.nblocks,
+ inodestart %d bmap start %d bsize %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
-          sb.bmapstart);
+          sb.bmapstart, sb.bsize);
+  if(sb.bsize != BSIZE)
+    panic("iinit: block size");
+  bsuminit(dev);
+  imapinit(dev);
+  dcinit();
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// Report inode cache statistics.
+static void
+istat(struct iostat *st)
+{
+  acquire(&icache.lock);
+  st->ihits = icache.hits;
+  st->imisses = icache.misses;
+  st->ninode = icache.n;
+  release(&icache.lock);
+}
+
 //PAGEBREAK!
-// Allocate an inode on device dev.
+// Inode allocation.
+//
+// Which inodes are free is kept in a bitmap in memory, built
+// at mount time from the inode blocks, so that ialloc need not
+// read inode blocks from the first one on until it finds a
+// free inode.  A new file's inode is sought starting at its
+// directory's, so that the two are likely to share an inode
+// block and, through bgoal, a region of the disk.  A new
+// directory gets an inode block of its own if there is one
+// left, sought round-robin from after the last directory's, so
+// that directories and their files spread over the disk.
+
+struct {
+  struct spinlock lock;
+  uchar used[NINODES/8 + 1];
+  uint cursor;  // inode block after the last directory's
+} imap;
+
+static void
+imapinit(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  uint b, i, inum;
+
+  initlock(&imap.lock, "imap");
+  if(sb.ninodes > NINODES)
+    panic("imapinit: too many inodes");
+  imap.used[0] = 1;  // inode 0 is not used
+  for(b = 0; b*IPB < sb.ninodes; b++){
+    bp = bread(dev, sb.inodestart + b);
+    dip = (struct dinode*)bp->data;
+    for(i = 0; i < IPB; i++){
+      inum = b*IPB + i;
+      if(inum < sb.ninodes && dip[i].type != 0)
+        imap.used[inum/8] |= 1 << (inum%8);
+    }
+    brelse(bp);
+  }
+}
+
+static int
+iinuse(uint inum)
+{
+  return inum >= sb.ninodes || (imap.used[inum/8] & (1 << (inum%8)));
+}
+
+// Find a free inode at or after start, wrapping around, mark it
+// used, and return its number.  If whole, find only an inode
+// whose inode block is entirely free.  Return 0 if there is none.
+// Caller must hold imap.lock.
+static uint
+ifind(uint start, int whole)
+{
+  uint i, j, inum, n;
+
+  n = (sb.ninodes + IPB - 1) / IPB * IPB;
+  start %= n;
+  for(i = 0; i < n; i++){
+    inum = (start + i) % n;
+    if(whole){
+      if(inum % IPB != 0)
+        continue;
+      for(j = 0; j < IPB && !iinuse(inum + j); j++)
+        ;
+      if(j < IPB)
+        continue;
+    } else if(inum % 8 == 0 && imap.used[inum/8] == 0xff){
+      i += 7;
+      continue;
+    } else if(iinuse(inum))
+      continue;
+    imap.used[inum/8] |= 1 << (inum%8);
+    return inum;
+  }
+  return 0;
+}
+
+// Allocate an inode on device dev, near inode near.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
 struct inode*
-ialloc(uint dev, short type)
+ialloc(uint dev, short type, uint near)
 {
-  int inum;
+  uint inum;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
-    brelse(bp);
-  }
-  panic("ialloc: no inodes");
+  acquire(&imap.lock);
+  inum = 0;
+  if(type == T_DIR && (inum = ifind(imap.cursor * IPB, 1)) != 0)
+    imap.cursor = inum/IPB + 1;
+  if(inum == 0)
+    inum = ifind(near, 0);
+  release(&imap.lock);
+  if(inum == 0)
+    panic("ialloc: no inodes");
+
+  bp = bread(dev, IBLOCK(inum, sb));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: inode in use");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  if(type == T_FILE)
+    dip->type |= I_INLINE;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
+}
+
+// Mark inode inum free in the in-memory bitmap,
+// after its type has been cleared.
+static void
+ifree(uint inum)
+{
+  acquire(&imap.lock);
+  imap.used[inum/8] &= ~(1 << (inum%8));
+  release(&imap.lock);
 }
 
 // Copy a modified in-memory inode to disk.
@@ -225,47 +580,132 @@ iupdate(struct inode *ip)
 
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
-  dip->type = ip->type;
+  dip->type = ip->type | ip->flags;
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
-  memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
+  memmove(dip->data, ip->data, sizeof(ip->data));
   log_write(bp);
   brelse(bp);
 }
 
+// Add ip to the LRU list: at the tail if it may be found
+// again, at the head if it should be recycled first.
+// Caller must hold icache.lock.
+static void
+lruadd(struct inode *ip, int tail)
+{
+  ip->lprev = 0;
+  ip->lnext = 0;
+  if(icache.lru == 0)
+    icache.lru = icache.lrutail = ip;
+  else if(tail){
+    ip->lprev = icache.lrutail;
+    icache.lrutail->lnext = ip;
+    icache.lrutail = ip;
+  } else {
+    ip->lnext = icache.lru;
+    icache.lru->lprev = ip;
+    icache.lru = ip;
+  }
+}
+
+// Remove ip from the LRU list.
+// Caller must hold icache.lock.
+static void
+lrudel(struct inode *ip)
+{
+  if(ip->lprev)
+    ip->lprev->lnext = ip->lnext;
+  else
+    icache.lru = ip->lnext;
+  if(ip->lnext)
+    ip->lnext->lprev = ip->lprev;
+  else
+    icache.lrutail = ip->lprev;
+}
+
+// Remove ip from its hash chain, if it is on one.
+// Caller must hold icache.lock.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  if(ip->inum == 0)
+    return;
+  for(pp = &icache.hash[IHASH(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext)
+    if(*pp == ip){
+      *pp = ip->hnext;
+      break;
+    }
+}
+
+// Add a page of free entries to the cache, at the head of the
+// LRU list.  They hold inode 0, which is never used, and are
+// not hashed.  Returns 0 if the cache is at its maximum size
+// or there is no memory.
+// Caller must hold icache.lock.
+static int
+igrow(void)
+{
+  struct inode *ip;
+  char *mem;
+  int i;
+
+  if(icache.n + IPP > NINODEMAX || (mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  for(i = 0; i < IPP; i++){
+    ip = (struct inode*)mem + i;
+    initsleeplock(&ip->lock, "inode");
+    lruadd(ip, 0);
+  }
+  icache.n += IPP;
+  return 1;
+}
+
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lrudel(ip);
+      icache.hits++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Recycle the least recently used entry.
+  if(icache.n < NINODE || icache.lru == 0)
+    igrow();
+  if((ip = icache.lru) == 0)
     panic("iget: no inodes");
+  lrudel(ip);
+  iunhash(ip);
+  icache.misses++;
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->dcdir = 0;
+  ip->ralast = 0;
+  ip->rawin = 0;
+  ip->raend = 0;
+  ip->hnext = icache.hash[IHASH(dev, inum)];
+  icache.hash[IHASH(dev, inum)] = ip;
   release(&icache.lock);
 
   return ip;
@@ -298,13 +738,17 @@ ilock(struct inode *ip)
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
-    ip->type = dip->type;
+    ip->type = dip->type & ~I_FLAGS;
+    ip->flags = dip->type & I_FLAGS;
     ip->major = dip->major;
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
     ip->size = dip->size;
-    memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    memmove(ip->data, dip->data, sizeof(ip->data));
     brelse(bp);
+    ip->bmbn = 0;
+    memset(ip->bmaddr, 0, sizeof(ip->bmaddr));
+    ip->balast = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -323,7 +767,7 @@ iunlock(struct inode *ip)
 
 // Drop a reference to an in-memory inode.
 // If that was the last reference, the inode cache entry can
-// be recycled.
+// be recycled, and stays valid until it is.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -338,16 +782,21 @@ iput(struct inode *ip)
     release(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcpurge(ip);
       itrunc(ip);
       ip->type = 0;
+      ip->flags = 0;
       iupdate(ip);
+      ifree(ip->inum);
       ip->valid = 0;
     }
   }
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0)
+    lruadd(ip, ip->valid);
   release(&icache.lock);
 }
 
@@ -365,40 +814,207 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT].  The next NDINDIRECT
+// are listed in the indirect blocks listed in the
+// double-indirect block ip->addrs[NDIRECT+1].
+//
+// A new regular file instead keeps its content in the inode,
+// in ip->data (I_INLINE), until it grows past NINLINE bytes;
+// then writei moves the content to a block.
+//
+// So that sequential access need not read an indirect block
+// for every data block, bmap keeps the group of BMCACHE
+// addresses around the last one it found in an indirect block
+// in ip->bmaddr.
+
+// Return entry i of indirect block addr, allocating a block
+// if there is none, and cache the entries around it.
+// fbn is the file block that entry i maps.
+static uint
+bmapind(struct inode *ip, uint addr, uint i, uint fbn)
+{
+  uint *a;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    a[i] = addr = ballocip(ip);
+    log_write(bp);
+  }
+  ip->bmbn = fbn - i%BMCACHE;
+  memmove(ip->bmaddr, a + i - i%BMCACHE, sizeof(ip->bmaddr));
+  brelse(bp);
+  return addr;
+}
+
+// Extent-mapped inodes (I_EXTENT) list their blocks as runs of
+// consecutive disk blocks instead.  Since files have no holes,
+// the extents map the file's blocks in order, and a block past
+// the last one mapped is the next block appended.  It is
+// placed right after the last extent if that block is free,
+// growing the extent; otherwise it starts a new extent at a
+// run of free blocks.
+
+// Return the disk block address of the nth block of extent-
+// mapped inode ip, allocating it if bn is the first block not
+// yet mapped.  Return 0 if ip has no room for another extent.
+static uint
+ebmap(struct inode *ip, uint bn)
+{
+  struct extent *ex, *last;
+  struct buf *bp;
+  uint i, addr;
+
+  ex = (struct extent*)ip->addrs;
+  last = 0;
+  for(i = 0; i < NEXTENT && ex[i].len; i++){
+    if(bn < ex[i].len)
+      return ex[i].start + bn;
+    bn -= ex[i].len;
+    last = &ex[i];
+  }
+  bp = 0;
+  if(i == NEXTENT && ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+    ex = (struct extent*)bp->data;
+    for(i = 0; i < NEXTBLK && ex[i].len; i++){
+      if(bn < ex[i].len){
+        addr = ex[i].start + bn;
+        brelse(bp);
+        return addr;
+      }
+      bn -= ex[i].len;
+      last = &ex[i];
+    }
+    i += NEXTENT;
+  }
+  if(bn != 0)
+    panic("ebmap: hole");
+
+  if(last && (addr = ballocat(ip->dev, last->start + last->len)) != 0){
+    ip->balast = addr;
+    last->len++;
+    if(bp && last >= ex && last < ex + NEXTBLK)
+      log_write(bp);
+  } else if(i == NEXTENT + NEXTBLK){
+    addr = 0;
+  } else {
+    if(i >= NEXTENT && bp == 0){
+      ip->addrs[NDIRECT+1] = ballocip(ip);
+      bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+      ex = (struct extent*)bp->data;
+    }
+    addr = ballocrun(ip->dev, ip->balast ? ip->balast + 1 : bgoal(ip), EXTRUN);
+    ip->balast = addr;
+    if(i < NEXTENT)
+      ex = (struct extent*)ip->addrs;
+    else {
+      i -= NEXTENT;
+      log_write(bp);
+    }
+    ex[i].start = addr;
+    ex[i].len = 1;
+  }
+  if(bp)
+    brelse(bp);
+  return addr;
+}
+
+// Free the blocks of extent-mapped inode ip.
+static void
+etrunc(struct inode *ip)
+{
+  struct extent *ex;
+  struct buf *bp;
+  int i;
+  uint b;
+
+  ex = (struct extent*)ip->addrs;
+  for(i = 0; i < NEXTENT; i++)
+    for(b = 0; b < ex[i].len; b++)
+      bfree(ip->dev, ex[i].start + b);
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+    ex = (struct extent*)bp->data;
+    for(i = 0; i < NEXTBLK; i++)
+      for(b = 0; b < ex[i].len; b++)
+        bfree(ip->dev, ex[i].start + b);
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+  }
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one.  Return 0
+// if it cannot.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, *a, fbn;
   struct buf *bp;
 
+  if(ip->flags & I_EXTENT)
+    return ebmap(ip, bn);
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = ballocip(ip);
     return addr;
   }
+  if(bn - ip->bmbn < BMCACHE && (addr = ip->bmaddr[bn - ip->bmbn]) != 0)
+    return addr;
+  fbn = bn;
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = ballocip(ip);
+    return bmapind(ip, addr, bn, fbn);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load double-indirect block, then the indirect block.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = ballocip(ip);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((addr = a[bn / NINDIRECT]) == 0){
+      a[bn / NINDIRECT] = addr = ballocip(ip);
       log_write(bp);
     }
     brelse(bp);
-    return addr;
+    return bmapind(ip, addr, bn % NINDIRECT, fbn);
   }
 
   panic("bmap: out of range");
 }
 
+// Free indirect block addr and the blocks it lists.
+// If depth is 2, they are indirect blocks too.
+static void
+bfreeind(uint dev, uint addr, int depth)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      bfreeind(dev, a[j], depth-1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -407,10 +1023,20 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
+  if(ip->flags & I_INLINE){
+    memset(ip->data, 0, sizeof(ip->data));
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
+  if(ip->flags & I_EXTENT){
+    etrunc(ip);
+    ip->size = 0;
+    iupdate(ip);
+    return;
+  }
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -419,16 +1045,16 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfreeind(ip->dev, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
+  if(ip->addrs[NDIRECT+1]){
+    bfreeind(ip->dev, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+  ip->bmbn = 0;
+  memset(ip->bmaddr, 0, sizeof(ip->bmaddr));
+  ip->balast = 0;
 
   ip->size = 0;
   iupdate(ip);
@@ -446,6 +1072,32 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Read-ahead.  A read that starts in or just after the last
+// block of the previous read is sequential: prefetch the next
+// ip->rawin blocks after it, doubling the window each time
+// (up to RAMAX) as long as the reads stay sequential.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint first, uint last)
+{
+  uint bn, end;
+
+  if(first == ip->ralast || first == ip->ralast + 1)
+    ip->rawin = ip->rawin ? min(2*ip->rawin, RAMAX) : RAMIN;
+  else {
+    ip->rawin = 0;
+    ip->raend = 0;
+  }
+  ip->ralast = last;
+  if(ip->rawin == 0)
+    return;
+
+  end = min(last + 1 + ip->rawin, (ip->size + BSIZE - 1) / BSIZE);
+  for(bn = max(last + 1, ip->raend); bn < end; bn++)
+    bprefetch(ip->dev, bmap(ip, bn));
+  ip->raend = max(ip->raend, end);
+}
+
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
@@ -465,14 +1117,63 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     return -1;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(ip->flags & I_INLINE)
+    memmove(dst, ip->data + off, n);
+  else {
+    if(n > 0)
+      readahead(ip, off/BSIZE, (off + n - 1)/BSIZE);
+    for(tot=0; tot<n; tot+=m){
+      bp = bread(ip->dev, bmap(ip, (off+tot)/BSIZE));
+      m = min(n - tot, BSIZE - (off+tot)%BSIZE);
+      memmove(dst + tot, bp->data + (off+tot)%BSIZE, m);
+      brelse(bp);
+    }
+  }
+  // Pages mapped by mmap hold stores not yet written back.
+  if(ip->nmpage)
+    mmapread(ip, dst, off, n);
+  return n;
+}
 
-  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(dst, bp->data + off%BSIZE, m);
+// Move the content of inline inode ip to a data block, as the
+// file is about to outgrow the inode.  Later blocks are mapped
+// with extents if the file system uses them.
+static int
+iuninline(struct inode *ip)
+{
+  char data[NINLINE];
+  uint bmaddr[BMCACHE];
+  struct buf *bp;
+  uint addr, bmbn;
+  short oflags;
+
+  // Save what is changed below, to undo it on failure.
+  memmove(data, ip->data, sizeof(data));
+  oflags = ip->flags;
+  bmbn = ip->bmbn;
+  memmove(bmaddr, ip->bmaddr, sizeof(bmaddr));
+
+  memset(ip->data, 0, sizeof(ip->data));
+  ip->flags &= ~I_INLINE;
+  if(sb.flags & SB_EXTENTS)
+    ip->flags |= I_EXTENT;
+  ip->bmbn = 0;
+  memset(ip->bmaddr, 0, sizeof(ip->bmaddr));
+  if(ip->size > 0){
+    if((addr = bmap(ip, 0)) == 0){
+      ip->flags = oflags;
+      ip->bmbn = bmbn;
+      memmove(ip->bmaddr, bmaddr, sizeof(bmaddr));
+      memmove(ip->data, data, sizeof(data));
+      return -1;
+    }
+    bp = bread(ip->dev, addr);
+    memmove(bp->data, data, ip->size);
+    log_write(bp);
     brelse(bp);
   }
-  return n;
+  iupdate(ip);
+  return 0;
 }
 
 // PAGEBREAK!
@@ -481,7 +1182,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -492,22 +1193,41 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if(n > 0 && (off + n - 1)/BSIZE >= MAXFILE)
     return -1;
 
-  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
+  if(ip->flags & I_INLINE){
+    if(off + n <= NINLINE){
+      memmove(ip->data + off, src, n);
+      if(off + n > ip->size)
+        ip->size = off + n;
+      iupdate(ip);
+      if(ip->nmpage)
+        mmapwrite(ip, src, off, n);
+      return n;
+    }
+    if(iuninline(ip) < 0)
+      return -1;
+  }
+
+  for(tot=0; tot<n; tot+=m){
+    if((addr = bmap(ip, (off+tot)/BSIZE)) == 0)
+      break;
+    bp = bread(ip->dev, addr);
+    m = min(n - tot, BSIZE - (off+tot)%BSIZE);
+    memmove(bp->data + (off+tot)%BSIZE, src + tot, m);
     log_write(bp);
     brelse(bp);
   }
 
-  if(n > 0 && off > ip->size){
-    ip->size = off;
+  if(tot > 0 && off + tot > ip->size){
+    ip->size = off + tot;
     iupdate(ip);
   }
-  return n;
+  // Keep pages mapped by mmap the same as the file.
+  if(ip->nmpage)
+    mmapwrite(ip, src, off, tot);
+  return tot;
 }
 
 //PAGEBREAK!
@@ -519,31 +1239,410 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directories are read and written a block at a time, not
+// through readi/writei, so that a search looks at each block
+// once.  Small directories are a plain sequence of dirents.  A
+// directory whose first block is full and that needs another
+// entry is converted to the hashed format described in fs.h,
+// which uses extendible hashing: a full bucket is split in two
+// by one more bit of the hash, doubling the table when the
+// bucket already uses every bit the table does.  A bucket whose
+// names would not be separated by the split, or whose table
+// cannot grow, gets an overflow block instead.  Entries are
+// never moved except by a split, so an offset from dirlookup
+// remains valid while the directory is locked.
+
+#define DIRHDR(bp) ((struct dirhdr*)((struct dirent*)(bp)->data + 2))
+#define BKTHDR(bp) ((struct bkthdr*)(bp)->data)
+
+// Return a locked buf holding block bn of directory dp.
+static struct buf*
+dirblock(struct inode *dp, uint bn)
+{
+  return bread(dp->dev, bmap(dp, bn));
+}
+
+// FNV-1a hash of a directory entry name.
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+// Address of entry i of the bucket table in block 0.
+static ushort*
+dirtab(struct buf *bp, uint i)
+{
+  return (ushort*)((struct dirent*)bp->data + DTSLOT + i/DTPS) + 1 + i%DTPS;
+}
+
+// Return the index of the entry for name among entries
+// [from, to) of the directory block in bp, or -1.
+static int
+dirscan(struct buf *bp, int from, int to, char *name)
+{
+  struct dirent *de;
+  int i;
+
+  de = (struct dirent*)bp->data;
+  for(i = from; i < to; i++)
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0)
+      return i;
+  return -1;
+}
+
+// Return the index of the first empty entry at or after from
+// in the directory block in bp, or -1.
+static int
+dirfree(struct buf *bp, int from)
+{
+  struct dirent *de;
+  int i;
+
+  de = (struct dirent*)bp->data;
+  for(i = from; i < DPB; i++)
+    if(de[i].inum == 0)
+      return i;
+  return -1;
+}
+
+// Fill in entry i of the directory block in bp.
+static void
+dirput(struct buf *bp, int i, char *name, uint inum)
+{
+  struct dirent *de;
+
+  de = (struct dirent*)bp->data + i;
+  strncpy(de->name, name, DIRSIZ);
+  de->inum = inum;
+  log_write(bp);
+}
+
+// Return the inode of entry i of directory block bn, held
+// in bp, and set *poff to the entry's offset.  Releases bp.
+static struct inode*
+dirfound(struct inode *dp, struct buf *bp, uint bn, int i, uint *poff)
+{
+  uint inum;
+
+  if(poff)
+    *poff = bn*BSIZE + i*sizeof(struct dirent);
+  inum = ((struct dirent*)bp->data)[i].inum;
+  brelse(bp);
+  return iget(dp->dev, inum);
+}
+
+// Look for a directory entry in a hashed directory.
+static struct inode*
+hdirlookup(struct inode *dp, char *name, uint *poff)
+{
+  struct buf *bp;
+  uint bn, next;
+  int i;
+
+  bp = dirblock(dp, 0);
+  if((i = dirscan(bp, 0, 2, name)) >= 0)
+    return dirfound(dp, bp, 0, i, poff);
+  bn = *dirtab(bp, dirhash(name) & ((1 << DIRHDR(bp)->depth) - 1));
+  brelse(bp);
+
+  // Search the bucket and its overflow blocks.
+  while(bn != 0){
+    bp = dirblock(dp, bn);
+    if((i = dirscan(bp, 1, DPB, name)) >= 0)
+      return dirfound(dp, bp, bn, i, poff);
+    next = BKTHDR(bp)->next;
+    brelse(bp);
+    bn = next;
+  }
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
-  struct dirent de;
+  struct buf *bp;
+  uint bn;
+  int i;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
+  if(dp->flags & I_HASHDIR)
+    return hdirlookup(dp, name, poff);
+
+  for(bn = 0; bn*BSIZE < dp->size; bn++){
+    bp = dirblock(dp, bn);
+    i = dirscan(bp, 0, min(DPB, (dp->size - bn*BSIZE) / sizeof(struct dirent)), name);
+    if(i >= 0)
+      return dirfound(dp, bp, bn, i, poff);
+    brelse(bp);
+  }
+  return 0;
+}
+
+// Copy up to n entries of directory dp, from byte offset *off
+// on, to ents, with their inodes' attributes if attrs, and
+// advance *off past them.  Return the number copied.  The
+// attributes come from the inode blocks, which iupdate keeps
+// current, so that no inode need be cached or locked.
+// Caller must hold dp->lock.
+int
+dirread(struct inode *dp, uint *off, struct gdent *ents, int n, int attrs)
+{
+  struct buf *bp, *ibp;
+  struct dirent *de;
+  struct dinode *dip;
+  struct gdent *e;
+  int i, k;
+
+  if(dp->type != T_DIR)
+    panic("dirread not DIR");
+
+  *off = (*off + sizeof(*de) - 1) / sizeof(*de) * sizeof(*de);
+  k = 0;
+  while(k < n && *off < dp->size){
+    bp = dirblock(dp, *off / BSIZE);
+    de = (struct dirent*)bp->data;
+    for(i = *off % BSIZE / sizeof(*de); i < DPB && k < n && *off < dp->size; i++){
+      *off += sizeof(*de);
+      if(de[i].inum == 0)
+        continue;
+      e = &ents[k++];
+      e->ino = de[i].inum;
+      memmove(e->name, de[i].name, DIRSIZ);
+      e->name[DIRSIZ] = 0;
+      e->type = e->nlink = e->size = 0;
+      if(attrs){
+        ibp = bread(dp->dev, IBLOCK(e->ino, sb));
+        dip = (struct dinode*)ibp->data + e->ino%IPB;
+        e->type = dip->type & ~I_FLAGS;
+        e->nlink = dip->nlink;
+        e->size = dip->size;
+        brelse(ibp);
+      }
+    }
+    brelse(bp);
+  }
+  return k;
+}
+
+// Convert directory dp, whose one block is full, to the hashed
+// format: block 0 keeps "." and ".." and gets a table whose
+// one entry is block 1, to which the other entries move.
+// Return -1 if dp does not start with "." and "..".
+static int
+dirconvert(struct inode *dp)
+{
+  struct buf *bp, *nbp;
+  struct dirent *de;
+
+  bp = dirblock(dp, 0);
+  de = (struct dirent*)bp->data;
+  if(namecmp(de[0].name, ".") != 0 || namecmp(de[1].name, "..") != 0){
+    brelse(bp);
+    return -1;
+  }
+  nbp = dirblock(dp, 1);
+  memmove(nbp->data, bp->data, BSIZE);
+  memset(nbp->data, 0, 2*sizeof(struct dirent));  // bkthdr and ".."
+  memset(de + 2, 0, BSIZE - 2*sizeof(struct dirent));
+  DIRHDR(bp)->magic = DIRMAGIC;
+  *dirtab(bp, 0) = 1;
+  log_write(nbp);
+  log_write(bp);
+  brelse(nbp);
+  brelse(bp);
+
+  dp->flags |= I_HASHDIR;
+  dp->size = 2*BSIZE;
+  iupdate(dp);
+  return 0;
+}
+
+// Append a block to hashed directory dp for a new bucket with
+// local depth depth.  Return it locked, and its block number in
+// *pbn, or 0 if dp cannot grow.
+static struct buf*
+dirgrow(struct inode *dp, uint depth, uint *pbn)
+{
+  struct buf *bp;
+  uint bn, addr;
+
+  bn = dp->size / BSIZE;
+  if(bn >= MAXFILE || bn > 0xffff || (addr = bmap(dp, bn)) == 0)
+    return 0;
+  bp = bread(dp->dev, addr);
+  BKTHDR(bp)->depth = depth;
+  log_write(bp);
+  dp->size += BSIZE;
+  iupdate(dp);
+  *pbn = bn;
+  return bp;
+}
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
+// Split bucket bn, a single full block held in bp, by one more
+// bit of the hash, doubling the table in b0 if need be.  The
+// names with the bit set move to a new bucket.  If the names all
+// fall on one side, none move; the table entries for the other
+// side become 0, an empty bucket, and no block is added.
+// Return -1, changing nothing, if the table or dp cannot grow.
+static int
+dirsplit(struct inode *dp, struct buf *b0, struct buf *bp, uint bn)
+{
+  struct dirhdr *dh;
+  struct dirent *de, *nde;
+  struct buf *nbp;
+  uint bit, depth, i, j, n, nbn;
+
+  dh = DIRHDR(b0);
+  depth = BKTHDR(bp)->depth;
+  bit = 1 << depth;
+  if(depth == dh->depth && (2 << dh->depth) > DTMAX)
+    return -1;
+  de = (struct dirent*)bp->data;
+  n = 0;
+  for(i = 1; i < DPB; i++)
+    if(dirhash(de[i].name) & bit)
+      n++;
+  nbp = 0;
+  nbn = 0;
+  if(n > 0 && n < DPB-1 && (nbp = dirgrow(dp, depth + 1, &nbn)) == 0)
+    return -1;
+
+  if(depth == dh->depth){
+    for(i = 0; i < (1 << dh->depth); i++)
+      *dirtab(b0, i + (1 << dh->depth)) = *dirtab(b0, i);
+    dh->depth++;
+  }
+  for(i = 0; i < (1 << dh->depth); i++){
+    if(*dirtab(b0, i) != bn)
       continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+    if(n == DPB-1 && !(i & bit))
+      *dirtab(b0, i) = 0;
+    else if(n < DPB-1 && (i & bit))
+      *dirtab(b0, i) = nbn;
+  }
+  log_write(b0);
+  BKTHDR(bp)->depth++;
+  log_write(bp);
+  if(nbp == 0)
+    return 0;
+
+  nde = (struct dirent*)nbp->data;
+  j = 1;
+  for(i = 1; i < DPB; i++){
+    if(dirhash(de[i].name) & bit){
+      nde[j++] = de[i];
+      memset(&de[i], 0, sizeof(de[i]));
+    }
+  }
+  log_write(nbp);
+  brelse(nbp);
+  return 0;
+}
+
+// Write a new entry into a hashed directory.  A full bucket is
+// split until the name's half has room; only when the table
+// cannot grow is an overflow block chained to the bucket.
+// Splits that move no names add no block, so at most one
+// block is added.
+static int
+hdirlink(struct inode *dp, char *name, uint inum)
+{
+  struct buf *b0, *bp, *nbp;
+  uint h, x, bn, first, nbn;
+  int i;
+
+  h = dirhash(name);
+  b0 = dirblock(dp, 0);
+  for(;;){
+    x = h & ((1 << DIRHDR(b0)->depth) - 1);
+    first = bn = *dirtab(b0, x);
+    if(bn == 0){
+      // An empty bucket: give it a block.
+      if((bp = dirgrow(dp, DIRHDR(b0)->depth, &bn)) == 0){
+        brelse(b0);
+        return -1;
+      }
+      *dirtab(b0, x) = bn;
+      log_write(b0);
+      dirput(bp, 1, name, inum);
+      brelse(bp);
+      brelse(b0);
+      return 0;
+    }
+    bp = dirblock(dp, bn);
+    while((i = dirfree(bp, 1)) < 0 && BKTHDR(bp)->next != 0){
+      bn = BKTHDR(bp)->next;
+      brelse(bp);
+      bp = dirblock(dp, bn);
+    }
+    if(i >= 0){
+      dirput(bp, i, name, inum);
+      brelse(bp);
+      brelse(b0);
+      return 0;
+    }
+    if(bn != first || dirsplit(dp, b0, bp, bn) < 0)
+      break;
+    brelse(bp);
+  }
+
+  // The bucket can't be split: chain an overflow
+  // block to its last block.
+  if((nbp = dirgrow(dp, BKTHDR(bp)->depth, &nbn)) == 0){
+    brelse(bp);
+    brelse(b0);
+    return -1;
+  }
+  BKTHDR(bp)->next = nbn;
+  log_write(bp);
+  dirput(nbp, 1, name, inum);
+  brelse(nbp);
+  brelse(bp);
+  brelse(b0);
+  return 0;
+}
+
+// Write a new entry into a directory in the plain format,
+// converting it to the hashed format if it is time to.
+static int
+ldirlink(struct inode *dp, char *name, uint inum)
+{
+  struct buf *bp;
+  struct dirent de;
+  uint bn, off;
+  int i;
+
+  // Look for an empty dirent.
+  for(bn = 0; bn*BSIZE < dp->size; bn++){
+    bp = dirblock(dp, bn);
+    i = dirfree(bp, 0);
+    if(i >= 0 && bn*BSIZE + i*sizeof(de) < dp->size){
+      dirput(bp, i, name, inum);
+      brelse(bp);
+      return 0;
     }
+    brelse(bp);
   }
 
+  // Append one, unless the directory should now be hashed.
+  off = dp->size;
+  if(off == BSIZE && dirconvert(dp) == 0)
+    return hdirlink(dp, name, inum);
+  memset(&de, 0, sizeof(de));
+  strncpy(de.name, name, DIRSIZ);
+  de.inum = inum;
+  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+    panic("dirlink");
   return 0;
 }
 
@@ -551,9 +1650,8 @@ dirlookup(struct inode *dp, char *name, uint *poff)
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
-  struct dirent de;
   struct inode *ip;
+  int r;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -561,20 +1659,167 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
+  if(dp->flags & I_HASHDIR)
+    r = hdirlink(dp, name, inum);
+  else
+    r = ldirlink(dp, name, inum);
+  if(r == 0)
+    dcenter(dp, name, inum);
+  return r;
+}
+
+//PAGEBREAK!
+// Directory entry cache.
+//
+// The cache remembers, for recently looked up names, which
+// inode the name refers to in its directory, or that it is not
+// there (inum 0), so that path lookup need not lock and search
+// the directory again.  An entry is updated by dirlink and by
+// unlink, while the directory is locked, and the entries of a
+// directory are dropped when its inode is freed, since the
+// inode number may be reused.  A miss recycles an entry chosen by a
+// clock sweep, as in bio.c.
+
+#define NDCACHE 256
+#define NDHASH  61
+
+struct dentry {
+  uint dev;
+  uint dir;            // directory's inode number; 0 if unused
+  char name[DIRSIZ];
+  uint inum;           // inode name refers to, or 0 if none
+  int used;            // clock reference bit
+  struct dentry *next; // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDCACHE];
+  struct dentry *hash[NDHASH];
+  int hand;
+  uint hits;
+  uint misses;
+} dcache;
+
+static void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static uint
+dchash(uint dev, uint dir, char *name)
+{
+  return (dirhash(name) + dev*31 + dir) % NDHASH;
+}
+
+// Return the entry for name in dp, or 0.
+// Caller must hold dcache.lock.
+static struct dentry*
+dcfind(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dchash(dp->dev, dp->inum, name)]; d; d = d->next)
+    if(d->dir == dp->inum && d->dev == dp->dev && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Remove d from its hash chain and mark it unused.
+// Caller must hold dcache.lock.
+static void
+dcfree(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dchash(d->dev, d->dir, d->name)]; *pp; pp = &(*pp)->next)
+    if(*pp == d){
+      *pp = d->next;
       break;
+    }
+  d->dir = 0;
+}
+
+// Look name up in directory dp in the cache.  If it is there,
+// set *ipp to its inode, referenced, or to 0 if the name is
+// known not to be in dp, and return 1.  Return 0 on a miss.
+// The inode is referenced before dcache.lock is released so
+// that an unlink cannot free it meanwhile.
+static int
+dclookup(struct inode *dp, char *name, struct inode **ipp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp, name)) == 0){
+    dcache.misses++;
+    release(&dcache.lock);
+    return 0;
   }
+  d->used = 1;
+  dcache.hits++;
+  *ipp = d->inum ? iget(dp->dev, d->inum) : 0;
+  release(&dcache.lock);
+  return 1;
+}
 
-  strncpy(de.name, name, DIRSIZ);
-  de.inum = inum;
-  if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-    panic("dirlink");
+// Record that name in directory dp refers to inode inum,
+// or to nothing if inum is 0, and mark dp, which is thus a
+// directory, as one namex may look up in without locking it.
+// Caller must hold dp->lock.
+void
+dcenter(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d;
+  uint h;
+
+  dp->dcdir = 1;
+  acquire(&dcache.lock);
+  if((d = dcfind(dp, name)) == 0){
+    for(;;){
+      d = &dcache.ent[dcache.hand];
+      dcache.hand = (dcache.hand + 1) % NDCACHE;
+      if(d->dir == 0 || !d->used)
+        break;
+      d->used = 0;
+    }
+    if(d->dir != 0)
+      dcfree(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dchash(d->dev, d->dir, d->name);
+    d->next = dcache.hash[h];
+    dcache.hash[h] = d;
+  }
+  d->inum = inum;
+  d->used = 1;
+  release(&dcache.lock);
+}
 
-  return 0;
+// Report directory entry cache statistics.
+static void
+dcstat(struct iostat *st)
+{
+  acquire(&dcache.lock);
+  st->dchits = dcache.hits;
+  st->dcmisses = dcache.misses;
+  release(&dcache.lock);
+}
+
+// Drop the entries of directory dp, which is being freed.
+static void
+dcpurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  dp->dcdir = 0;
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < dcache.ent+NDCACHE; d++)
+    if(d->dir == dp->inum && d->dev == dp->dev)
+      dcfree(d);
+  release(&dcache.lock);
 }
 
 //PAGEBREAK!
@@ -632,6 +1877,17 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    // ip->valid and ip->type need ip->lock, but dcdir, set
+    // under it by dcenter, stays set while ip is referenced,
+    // so a cached entry can be used without locking ip.
+    if(ip->dcdir && !(nameiparent && *path == '\0') &&
+       dclookup(ip, name, &next)){
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      continue;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -642,7 +1898,9 @@ namex(char *path, int nameiparent, char *name)
       iunlock(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
+    next = dirlookup(ip, name, 0);
+    dcenter(ip, name, next ? next->inum : 0);
+    if(next == 0){
       iunlockput(ip);
       return 0;
     }
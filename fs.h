@@ -3,7 +3,9 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#ifndef BSIZE
+#define BSIZE 512  // block size; set by make BLOCKSIZE=
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -19,11 +21,18 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes)
+  uint flags;        // SB_*
 };
 
-#define NDIRECT 12
+#define SB_EXTENTS 0x1  // new files use extents (mkfs -e)
+
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
+
+#define NINLINE 116  // bytes of data an inode can hold itself
 
 // On-disk inode structure
 struct dinode {
@@ -32,9 +41,30 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  union {
+    uint addrs[NDIRECT+2];   // Data block addresses
+    char data[NINLINE];      // Data, if I_INLINE
+  };
 };
 
+// Inode flags, kept in the high bits of dinode.type.
+#define I_EXTENT 0x100  // addrs holds extents, not block numbers
+#define I_HASHDIR 0x200 // directory is hashed
+#define I_INLINE 0x400  // data holds the file's content
+#define I_FLAGS  (I_EXTENT|I_HASHDIR|I_INLINE)
+
+// An extent: len consecutive blocks starting at start.
+// Extent-mapped files list their blocks, in file order, as
+// NEXTENT extents in addrs[], then NEXTBLK more in the block
+// addrs[NDIRECT+1].
+struct extent {
+  uint start;
+  uint len;
+};
+#define NEXTENT ((NDIRECT+1) / 2)
+#define NEXTBLK (BSIZE / sizeof(struct extent))
+#define EXTRUN  16  // free blocks sought for a new extent
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -55,3 +85,46 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+#define DPB (BSIZE / sizeof(struct dirent))  // dirents per block
+
+// Directory entry returned by getdents.  The inode's
+// attributes are filled in if GD_STAT is asked for.
+struct gdent {
+  uint ino;
+  short type;
+  short nlink;
+  uint size;
+  char name[DIRSIZ+1];  // null-terminated
+};
+
+#define GD_STAT 0x1
+
+// A directory that outgrows its first block is hashed
+// (I_HASHDIR).  Block 0 holds ".", "..", a dirhdr and a table
+// of 1<<depth bucket blocks, indexed by the low bits of a
+// name's hash; an entry of 0 stands for an empty bucket with no
+// block.  Every other block is a bucket, or an overflow block
+// chained from one, starting with a bkthdr.  A bucket overflows
+// only when the table is too big to split it.  Headers and table
+// entries fill dirent slots whose inum is 0, so they read as
+// empty entries and the directory can still be read as a
+// sequence of dirents.
+#define DIRMAGIC 0x6468
+#define DTSLOT 3     // block 0 slot holding the first table entries
+#define DTPS   7     // table entries per slot, after the zero inum
+#define DTMAX  ((DPB - DTSLOT) * DTPS)  // table entries that fit
+
+struct dirhdr {
+  ushort zero;       // always 0, in place of an inum
+  ushort magic;      // DIRMAGIC
+  ushort depth;      // hash bits used to index the table
+  ushort pad[5];
+};
+
+struct bkthdr {
+  ushort zero;       // always 0, in place of an inum
+  ushort depth;      // hash bits shared by the bucket's names
+  uint next;         // file block of the next overflow block, or 0
+  uint pad[2];
+};
+
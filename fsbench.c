@@ -0,0 +1,886 @@
+// File system benchmarks.
+// Run "fsbench" for all of them or "fsbench name ..." for some.
+// Each benchmark prints elapsed ticks and block I/O statistics.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fs.h"
+#include "fcntl.h"
+#include "iostat.h"
+#include "uio.h"
+
+#define NREADER   4   // concurrent processes in readpar
+#define RPBLOCKS  4   // blocks in each readpar file
+#define RPROUNDS  200 // times each reader reads its file
+#define WSFILES   16  // files in reread's working set
+#define WSBLOCKS  128 // blocks in each reread file
+#define NCREATE   100 // files in create
+#define NWRITER   4   // concurrent processes in createpar
+#define TPBYTES   (64*1024)  // size of the file in throughput
+#define TPROUNDS  20  // times throughput writes and reads it
+#define LFBYTES   (1024*1024)  // size of the file in largefile
+#define FILLPCT   80  // how full alloc makes the disk
+#define FILLBLKS  32  // blocks in each of alloc's filler files
+#define NALLOC    20  // files alloc times writing
+#define CMDIRS    15  // directories in createmany
+#define CMFILES   100 // files in each
+#define LKDEPTH   8   // directories in lookup's path
+#define LKROUNDS  2000 // times lookup opens it
+#define NNAMES    10000 // names in bigdir's directory
+#define LDFILES   500 // files in listdir's directory
+#define NSMALL    200 // files in smallfiles
+#define SMALLSZ   64  // bytes in each
+#define NENT      64  // entries per getdents call in listdir
+#define RRBLOCKS  256 // blocks in randread's file
+#define RRREADS   2000 // blocks randread reads in each pass
+#define NRECORD   500 // records logwrite appends in each pass
+#define LTBYTES   (64*1024) // size of mmaplookup's table
+#define NLOOKUP   20000 // entries mmaplookup reads in each pass
+
+char buf[BSIZE];
+
+struct iostat st0;
+int t0;
+
+void
+start(void)
+{
+  iostat(&st0);
+  t0 = uptime();
+}
+
+void
+report(char *name)
+{
+  struct iostat st;
+  int t;
+
+  t = uptime() - t0;
+  iostat(&st);
+  printf(1, "%s: %d ticks, cache %d hits %d misses %d evicts (%d buffers)\n",
+         name, t, st.bhits - st0.bhits, st.bmisses - st0.bmisses,
+         st.bevicts - st0.bevicts, st.nbuf);
+  printf(1, "%s: disk %d commands for %d blocks\n",
+         name, st.dcmds - st0.dcmds, st.dblocks - st0.dblocks);
+  if(st.qreqs != st0.qreqs)
+    printf(1, "%s: queue avg depth %d max %d, avg wait %d max %d ticks, %d expired\n",
+           name, (st.qdepthsum - st0.qdepthsum) / (st.qreqs - st0.qreqs),
+           st.qmaxdepth, (st.qwaitsum - st0.qwaitsum) / (st.qreqs - st0.qreqs),
+           st.qmaxwait, st.qexpired - st0.qexpired);
+  if(st.ihits + st.imisses != st0.ihits + st0.imisses)
+    printf(1, "%s: inode cache %d hits %d misses (%d inodes)\n",
+           name, st.ihits - st0.ihits, st.imisses - st0.imisses, st.ninode);
+  if(st.dchits + st.dcmisses != st0.dchits + st0.dcmisses)
+    printf(1, "%s: dentry cache %d hits %d misses\n",
+           name, st.dchits - st0.dchits, st.dcmisses - st0.dcmisses);
+  printf(1, "%s: %d commits of %d ops in %d ticks, %d checkpoints\n",
+         name, st.ncommit - st0.ncommit, st.nops - st0.nops,
+         st.cticks - st0.cticks, st.nckpt - st0.nckpt);
+  printf(1, "%s: %d log writes (%d absorbed) %d header writes %d home writes\n",
+         name, st.lwrites - st0.lwrites, st.labsorb - st0.labsorb,
+         st.lheads - st0.lheads, st.iwrites - st0.iwrites);
+}
+
+// Parallel reads: each reader process reads its own small file
+// over and over.  After the first pass every block should come
+// from the buffer cache, and readers on different CPUs should
+// not contend with each other.
+void
+readpar(void)
+{
+  char name[] = "rp0";
+  int i, j, fd, pid;
+
+  memset(buf, 'r', sizeof(buf));
+  for(i = 0; i < NREADER; i++){
+    name[2] = '0' + i;
+    fd = open(name, O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf(1, "readpar: create %s failed\n", name);
+      exit();
+    }
+    for(j = 0; j < RPBLOCKS; j++)
+      write(fd, buf, sizeof(buf));
+    close(fd);
+  }
+
+  start();
+  for(i = 0; i < NREADER; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "readpar: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      name[2] = '0' + i;
+      for(j = 0; j < RPROUNDS; j++){
+        if((fd = open(name, O_RDONLY)) < 0){
+          printf(1, "readpar: open %s failed\n", name);
+          exit();
+        }
+        while(read(fd, buf, sizeof(buf)) == sizeof(buf))
+          ;
+        close(fd);
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < NREADER; i++)
+    wait();
+  report("readpar");
+
+  for(i = 0; i < NREADER; i++){
+    name[2] = '0' + i;
+    unlink(name);
+  }
+}
+
+// Read a working set of WSFILES*WSBLOCKS blocks twice.
+// The buffer cache grows to hold all of it, so the second
+// pass should not miss at all.
+void
+reread(void)
+{
+  char name[] = "wsa";
+  int i, j, pass, fd;
+
+  memset(buf, 'w', sizeof(buf));
+  for(i = 0; i < WSFILES; i++){
+    name[2] = 'a' + i;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf(1, "reread: create %s failed\n", name);
+      exit();
+    }
+    for(j = 0; j < WSBLOCKS; j++)
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf(1, "reread: write %s failed\n", name);
+        exit();
+      }
+    close(fd);
+  }
+
+  for(pass = 0; pass < 2; pass++){
+    start();
+    for(i = 0; i < WSFILES; i++){
+      name[2] = 'a' + i;
+      fd = open(name, O_RDONLY);
+      while(read(fd, buf, sizeof(buf)) == sizeof(buf))
+        ;
+      close(fd);
+    }
+    report(pass == 0 ? "reread pass 1" : "reread pass 2");
+  }
+
+  for(i = 0; i < WSFILES; i++){
+    name[2] = 'a' + i;
+    unlink(name);
+  }
+}
+
+// Sequential read of a large file that is not yet cached,
+// as cat would do it.  Run right after boot for cold numbers.
+void
+seqread(void)
+{
+  int fd, n, tot;
+
+  if((fd = open("usertests", O_RDONLY)) < 0){
+    printf(1, "seqread: open usertests failed\n");
+    exit();
+  }
+  start();
+  tot = 0;
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    tot += n;
+  close(fd);
+  report("seqread");
+  printf(1, "seqread: %d bytes\n", tot);
+}
+
+// Create, write and delete NCREATE small files named
+// with prefix c.
+void
+createfiles(char c)
+{
+  char name[] = "c00";
+  int i, fd;
+
+  name[0] = c;
+  for(i = 0; i < NCREATE; i++){
+    name[1] = '0' + i/10;
+    name[2] = '0' + i%10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf(1, "create: create %s failed\n", name);
+      exit();
+    }
+    write(fd, buf, 100);
+    close(fd);
+  }
+  for(i = 0; i < NCREATE; i++){
+    name[1] = '0' + i/10;
+    name[2] = '0' + i%10;
+    unlink(name);
+  }
+}
+
+// Small-file creation in one directory.  The directory, inode
+// and bitmap blocks are changed by every call, so with write-back
+// each is written home once per checkpoint rather than once per
+// system call.
+void
+create(void)
+{
+  memset(buf, 'c', sizeof(buf));
+  start();
+  createfiles('c');
+  sync();
+  report("create");
+}
+
+// The same from NWRITER processes at once.  Calls that finish
+// while a commit is in progress join the next one.
+void
+createpar(void)
+{
+  int i, pid;
+
+  memset(buf, 'c', sizeof(buf));
+  start();
+  for(i = 0; i < NWRITER; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "createpar: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      createfiles('p' + i);
+      exit();
+    }
+  }
+  for(i = 0; i < NWRITER; i++)
+    wait();
+  sync();
+  report("createpar");
+}
+
+// Sequential write and read of a TPBYTES file in 4 KB system
+// calls, TPROUNDS times.  Every block costs a bread, a log slot
+// and a disk request, so this mostly measures per-block overhead:
+// compare a kernel built with make BLOCKSIZE=4096 with the
+// default 512-byte blocks.
+void
+throughput(void)
+{
+  static char tbuf[4096];
+  int i, j, fd, t, tw, tr;
+
+  memset(tbuf, 't', sizeof(tbuf));
+  tw = tr = 0;
+  start();
+  for(i = 0; i < TPROUNDS; i++){
+    t = uptime();
+    if((fd = open("tp", O_CREATE|O_RDWR)) < 0){
+      printf(1, "throughput: create tp failed\n");
+      exit();
+    }
+    for(j = 0; j < TPBYTES/sizeof(tbuf); j++)
+      if(write(fd, tbuf, sizeof(tbuf)) != sizeof(tbuf)){
+        printf(1, "throughput: write failed\n");
+        exit();
+      }
+    fsync(fd);
+    close(fd);
+    tw += uptime() - t;
+
+    t = uptime();
+    fd = open("tp", O_RDONLY);
+    while(read(fd, tbuf, sizeof(tbuf)) > 0)
+      ;
+    close(fd);
+    tr += uptime() - t;
+    unlink("tp");
+  }
+  report("throughput");
+  printf(1, "throughput: %d-byte blocks, %d KB written in %d ticks, read in %d ticks\n",
+         BSIZE, TPROUNDS*TPBYTES/1024, tw, tr);
+}
+
+// Sequential write, then read, of a LFBYTES file, large
+// enough to need the double-indirect block with 512-byte
+// blocks.  The read is served from the cache; its lookups
+// show how often bmap had to read an indirect block.
+void
+largefile(void)
+{
+  static char lbuf[4096];
+  int i, fd, n;
+
+  memset(lbuf, 'l', sizeof(lbuf));
+  if((fd = open("lf", O_CREATE|O_RDWR)) < 0){
+    printf(1, "largefile: create lf failed\n");
+    exit();
+  }
+  start();
+  for(i = 0; i < LFBYTES/sizeof(lbuf); i++)
+    if(write(fd, lbuf, sizeof(lbuf)) != sizeof(lbuf)){
+      printf(1, "largefile: write failed\n");
+      exit();
+    }
+  fsync(fd);
+  close(fd);
+  report("largefile write");
+
+  start();
+  fd = open("lf", O_RDONLY);
+  n = 0;
+  while((i = read(fd, lbuf, sizeof(lbuf))) > 0)
+    n += i;
+  close(fd);
+  report("largefile read");
+  if(n != LFBYTES)
+    printf(1, "largefile: read %d bytes, expected %d\n", n, LFBYTES);
+  unlink("lf");
+}
+
+// Block allocation on a disk that is FILLPCT% full: fill it
+// with files, delete every other one so that the free space is
+// scattered, then write NALLOC files of 8 blocks and report the
+// cost of each allocation.
+void
+alloc(void)
+{
+  char name[] = "af000";
+  struct iostat st;
+  int i, j, n, nf, fd;
+
+  memset(buf, 'a', sizeof(buf));
+  iostat(&st);
+  for(nf = 0; st.freeblocks > st.fsblocks * (100 - FILLPCT) / 100; nf++){
+    name[2] = '0' + nf/100;
+    name[3] = '0' + nf/10%10;
+    name[4] = '0' + nf%10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf(1, "alloc: create %s failed\n", name);
+      exit();
+    }
+    for(j = 0; j < FILLBLKS; j++)
+      write(fd, buf, sizeof(buf));
+    close(fd);
+    iostat(&st);
+  }
+  for(i = 0; i < nf; i += 2){
+    name[2] = '0' + i/100;
+    name[3] = '0' + i/10%10;
+    name[4] = '0' + i%10;
+    unlink(name);
+  }
+  sync();
+
+  start();
+  name[1] = 'n';
+  for(i = 0; i < NALLOC; i++){
+    name[2] = '0' + i/100;
+    name[3] = '0' + i/10%10;
+    name[4] = '0' + i%10;
+    fd = open(name, O_CREATE|O_RDWR);
+    for(j = 0; j < 8; j++)
+      write(fd, buf, sizeof(buf));
+    close(fd);
+  }
+  report("alloc");
+  iostat(&st);
+  n = st.nalloc - st0.nalloc;
+  if(n > 0)
+    printf(1, "alloc: %d%% full, %d blocks allocated, %d cycles and %d/100 bitmap reads each\n",
+           100 - st.freeblocks * 100 / st.fsblocks, n,
+           (st.acycles - st0.acycles) / n, (st.ascan - st0.ascan) * 100 / n);
+
+  for(i = 0; i < NALLOC; i++){
+    name[2] = '0' + i/100;
+    name[3] = '0' + i/10%10;
+    name[4] = '0' + i%10;
+    unlink(name);
+  }
+  name[1] = 'f';
+  for(i = 1; i < nf; i += 2){
+    name[2] = '0' + i/100;
+    name[3] = '0' + i/10%10;
+    name[4] = '0' + i%10;
+    unlink(name);
+  }
+}
+
+// Create CMDIRS*CMFILES empty files, CMFILES to a directory,
+// and report the cost of each batch.  The cost of a creation
+// should not grow with the number of inodes already in use.
+void
+createmany(void)
+{
+  char dir[] = "cm00", path[] = "cm00/f00";
+  struct iostat st;
+  int d, i, fd, t;
+
+  for(d = 0; d < CMDIRS; d++){
+    dir[2] = path[2] = '0' + d/10;
+    dir[3] = path[3] = '0' + d%10;
+    if(mkdir(dir) < 0){
+      printf(1, "createmany: mkdir %s failed\n", dir);
+      exit();
+    }
+    start();
+    for(i = 0; i < CMFILES; i++){
+      path[6] = '0' + i/10;
+      path[7] = '0' + i%10;
+      if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+        printf(1, "createmany: create %s failed\n", path);
+        exit();
+      }
+      close(fd);
+    }
+    t = uptime() - t0;
+    iostat(&st);
+    printf(1, "createmany: files %d-%d: %d ticks, %d block lookups per file\n",
+           d*CMFILES, (d+1)*CMFILES - 1, t,
+           (st.bhits + st.bmisses - st0.bhits - st0.bmisses) / CMFILES);
+  }
+
+  for(d = 0; d < CMDIRS; d++){
+    dir[2] = path[2] = '0' + d/10;
+    dir[3] = path[3] = '0' + d%10;
+    for(i = 0; i < CMFILES; i++){
+      path[6] = '0' + i/10;
+      path[7] = '0' + i%10;
+      unlink(path);
+    }
+    unlink(dir);
+  }
+}
+
+// Path lookup: open a file at the bottom of a deep directory
+// tree over and over.  Every component should be found in the
+// dentry cache, and its inode in the inode cache, without
+// locking or reading any directory.
+void
+lookup(void)
+{
+  char path[3*LKDEPTH + 2];
+  int i, fd;
+
+  for(i = 0; i < LKDEPTH; i++){
+    path[3*i] = 'l';
+    path[3*i+1] = '0' + i;
+    path[3*i+2] = 0;
+    if(mkdir(path) < 0){
+      printf(1, "lookup: mkdir %s failed\n", path);
+      exit();
+    }
+    path[3*i+2] = '/';
+  }
+  path[3*i] = 'f';
+  path[3*i+1] = 0;
+  if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+    printf(1, "lookup: create %s failed\n", path);
+    exit();
+  }
+  close(fd);
+
+  start();
+  for(i = 0; i < LKROUNDS; i++){
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf(1, "lookup: open %s failed\n", path);
+      exit();
+    }
+    close(fd);
+  }
+  report("lookup");
+  printf(1, "lookup: %d opens per tick\n", LKROUNDS / (uptime() - t0 + 1));
+
+  unlink(path);
+  for(i = LKDEPTH - 1; i >= 0; i--){
+    path[3*i+2] = 0;
+    unlink(path);
+  }
+}
+
+// Set the digits at the end of name to i.
+void
+numname(char *name, int i)
+{
+  char *p;
+
+  for(p = name + strlen(name) - 1; *p >= '0' && *p <= '9'; p--){
+    *p = '0' + i % 10;
+    i /= 10;
+  }
+}
+
+// Large directory: link one file under NNAMES names in one
+// directory, then look each of them up.
+void
+bigdir(void)
+{
+  char name[] = "bd/n00000";
+  int i, fd;
+
+  if(mkdir("bd") < 0 || (fd = open("bd/f", O_CREATE|O_RDWR)) < 0){
+    printf(1, "bigdir: create failed\n");
+    exit();
+  }
+  close(fd);
+
+  start();
+  for(i = 0; i < NNAMES; i++){
+    numname(name, i);
+    if(link("bd/f", name) < 0){
+      printf(1, "bigdir: link %s failed\n", name);
+      exit();
+    }
+  }
+  report("bigdir link");
+
+  start();
+  for(i = 0; i < NNAMES; i++){
+    numname(name, i);
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf(1, "bigdir: open %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+  report("bigdir lookup");
+
+  for(i = 0; i < NNAMES; i++){
+    numname(name, i);
+    unlink(name);
+  }
+  unlink("bd/f");
+  unlink("bd");
+}
+
+// Directory listing: list a directory of LDFILES files as ls
+// used to, reading one entry at a time and calling stat on each,
+// and then with getdents, which returns many entries and their
+// attributes in one call.
+void
+listdir(void)
+{
+  char path[] = "ld/f000", spath[3+DIRSIZ+1] = "ld/";
+  struct gdent ents[NENT];
+  struct dirent de;
+  struct stat st;
+  int i, n, fd, nsys;
+
+  if(mkdir("ld") < 0){
+    printf(1, "listdir: mkdir failed\n");
+    exit();
+  }
+  for(i = 0; i < LDFILES; i++){
+    numname(path, i);
+    if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+      printf(1, "listdir: create %s failed\n", path);
+      exit();
+    }
+    close(fd);
+  }
+
+  start();
+  fd = open("ld", O_RDONLY);
+  nsys = 1;
+  while(read(fd, &de, sizeof(de)) == sizeof(de)){
+    nsys++;
+    if(de.inum == 0)
+      continue;
+    memmove(spath+3, de.name, DIRSIZ);
+    spath[3+DIRSIZ] = 0;
+    stat(spath, &st);
+    nsys += 3;  // open, fstat, close
+  }
+  close(fd);
+  report("listdir read+stat");
+  printf(1, "listdir read+stat: %d system calls\n", nsys + 2);
+
+  start();
+  fd = open("ld", O_RDONLY);
+  nsys = 1;
+  while((n = getdents(fd, ents, NENT, GD_STAT)) > 0)
+    nsys++;
+  close(fd);
+  report("listdir getdents");
+  printf(1, "listdir getdents: %d system calls\n", nsys + 2);
+
+  for(i = 0; i < LDFILES; i++){
+    numname(path, i);
+    unlink(path);
+  }
+  unlink("ld");
+}
+
+// Small files: write and read back NSMALL files of SMALLSZ
+// bytes, which fit in their inodes and need no data blocks.
+void
+smallfiles(void)
+{
+  char path[] = "sf000";
+  struct iostat st;
+  int i, fd;
+
+  memset(buf, 's', SMALLSZ);
+  start();
+  for(i = 0; i < NSMALL; i++){
+    numname(path, i);
+    if((fd = open(path, O_CREATE|O_RDWR)) < 0 || write(fd, buf, SMALLSZ) != SMALLSZ){
+      printf(1, "smallfiles: write %s failed\n", path);
+      exit();
+    }
+    close(fd);
+  }
+  sync();
+  report("smallfiles write");
+  iostat(&st);
+  printf(1, "smallfiles write: %d blocks allocated\n", st.nalloc - st0.nalloc);
+
+  start();
+  for(i = 0; i < NSMALL; i++){
+    numname(path, i);
+    if((fd = open(path, O_RDONLY)) < 0 || read(fd, buf, SMALLSZ) != SMALLSZ){
+      printf(1, "smallfiles: read %s failed\n", path);
+      exit();
+    }
+    close(fd);
+  }
+  report("smallfiles read");
+
+  for(i = 0; i < NSMALL; i++){
+    numname(path, i);
+    unlink(path);
+  }
+}
+
+uint seed = 1;
+
+uint
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+// Read RRREADS random blocks of a file that fits in the buffer
+// cache.  Each block is filled with its block number.  The first
+// pass seeks before each read; the second uses pread, one system
+// call per block; the third has NREADER processes pread through
+// one shared descriptor, whose offset none of them moves.
+void
+randread(void)
+{
+  int i, b, fd, pid;
+
+  if((fd = open("rr", O_CREATE|O_RDWR)) < 0){
+    printf(1, "randread: create failed\n");
+    exit();
+  }
+  for(b = 0; b < RRBLOCKS; b++){
+    memset(buf, b, sizeof(buf));
+    write(fd, buf, sizeof(buf));
+  }
+
+  start();
+  for(i = 0; i < RRREADS; i++){
+    b = rand() % RRBLOCKS;
+    if(lseek(fd, b*BSIZE, SEEK_SET) != b*BSIZE ||
+       read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != (char)b){
+      printf(1, "randread: lseek+read of block %d failed\n", b);
+      exit();
+    }
+  }
+  report("randread lseek+read");
+
+  start();
+  for(i = 0; i < RRREADS; i++){
+    b = rand() % RRBLOCKS;
+    if(pread(fd, buf, sizeof(buf), b*BSIZE) != sizeof(buf) || buf[0] != (char)b){
+      printf(1, "randread: pread of block %d failed\n", b);
+      exit();
+    }
+  }
+  report("randread pread");
+
+  lseek(fd, 0, SEEK_SET);
+  start();
+  for(i = 0; i < NREADER; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "randread: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      seed += i;
+      for(i = 0; i < RRREADS/NREADER; i++){
+        b = rand() % RRBLOCKS;
+        if(pread(fd, buf, sizeof(buf), b*BSIZE) != sizeof(buf) || buf[0] != (char)b){
+          printf(1, "randread: shared pread of block %d failed\n", b);
+          exit();
+        }
+      }
+      exit();
+    }
+  }
+  for(i = 0; i < NREADER; i++)
+    wait();
+  report("randread shared pread");
+  if(lseek(fd, 0, SEEK_CUR) != 0)
+    printf(1, "randread: pread moved the offset\n");
+
+  close(fd);
+  unlink("rr");
+}
+
+// Append NRECORD records of a header, a body and a newline to
+// a log file, first with a write for each part and then with
+// one writev per record, which commits in one transaction.
+void
+logwrite(void)
+{
+  char hdr[] = "rec 000: ";
+  struct iovec iov[3];
+  int i, fd;
+
+  memset(buf, 'l', 100);
+  iov[0].base = hdr;
+  iov[0].len = strlen(hdr);
+  iov[1].base = buf;
+  iov[1].len = 100;
+  iov[2].base = "\n";
+  iov[2].len = 1;
+
+  if((fd = open("lw", O_CREATE|O_RDWR)) < 0){
+    printf(1, "logwrite: create failed\n");
+    exit();
+  }
+  start();
+  for(i = 0; i < NRECORD; i++){
+    hdr[6] = '0' + i % 10;
+    if(write(fd, iov[0].base, iov[0].len) != iov[0].len ||
+       write(fd, iov[1].base, iov[1].len) != iov[1].len ||
+       write(fd, iov[2].base, iov[2].len) != iov[2].len){
+      printf(1, "logwrite: write failed\n");
+      exit();
+    }
+  }
+  report("logwrite write");
+  printf(1, "logwrite write: %d system calls\n", 3*NRECORD);
+  close(fd);
+  unlink("lw");
+
+  if((fd = open("lw", O_CREATE|O_RDWR)) < 0){
+    printf(1, "logwrite: create failed\n");
+    exit();
+  }
+  start();
+  for(i = 0; i < NRECORD; i++){
+    hdr[6] = '0' + i % 10;
+    if(writev(fd, iov, 3) != iov[0].len + iov[1].len + iov[2].len){
+      printf(1, "logwrite: writev failed\n");
+      exit();
+    }
+  }
+  report("logwrite writev");
+  printf(1, "logwrite writev: %d system calls\n", NRECORD);
+  close(fd);
+  unlink("lw");
+}
+
+// Look up NLOOKUP random entries of a LTBYTES table file, first
+// with a pread for each and then through a read-only mapping,
+// which faults each page in once and then costs no system calls.
+void
+mmaplookup(void)
+{
+  int i, j, fd, *tab, v;
+
+  if((fd = open("lt", O_CREATE|O_RDWR)) < 0){
+    printf(1, "mmaplookup: create failed\n");
+    exit();
+  }
+  for(i = 0; i < LTBYTES/BSIZE; i++){
+    for(j = 0; j < BSIZE/sizeof(int); j++)
+      ((int*)buf)[j] = i*(BSIZE/sizeof(int)) + j;
+    write(fd, buf, sizeof(buf));
+  }
+
+  start();
+  for(i = 0; i < NLOOKUP; i++){
+    j = rand() % (LTBYTES/sizeof(int));
+    if(pread(fd, &v, sizeof(v), j*sizeof(int)) != sizeof(v) || v != j){
+      printf(1, "mmaplookup: pread of entry %d failed\n", j);
+      exit();
+    }
+  }
+  report("mmaplookup pread");
+
+  start();
+  if((tab = mmap(0, LTBYTES, PROT_READ, MAP_SHARED, fd, 0)) == (int*)-1){
+    printf(1, "mmaplookup: mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < NLOOKUP; i++){
+    j = rand() % (LTBYTES/sizeof(int));
+    if(tab[j] != j){
+      printf(1, "mmaplookup: entry %d wrong\n", j);
+      exit();
+    }
+  }
+  munmap(tab, LTBYTES);
+  report("mmaplookup mmap");
+
+  close(fd);
+  unlink("lt");
+}
+
+struct bench {
+  char *name;
+  void (*fn)(void);
+} benches[] = {
+  { "readpar", readpar },
+  { "reread", reread },
+  { "seqread", seqread },
+  { "create", create },
+  { "createpar", createpar },
+  { "throughput", throughput },
+  { "largefile", largefile },
+  { "alloc", alloc },
+  { "createmany", createmany },
+  { "lookup", lookup },
+  { "bigdir", bigdir },
+  { "listdir", listdir },
+  { "smallfiles", smallfiles },
+  { "randread", randread },
+  { "logwrite", logwrite },
+  { "mmaplookup", mmaplookup },
+  { 0, 0 },
+};
+
+int
+main(int argc, char *argv[])
+{
+  struct bench *b;
+  int i;
+
+  if(argc < 2){
+    for(b = benches; b->name; b++)
+      b->fn();
+    exit();
+  }
+  for(i = 1; i < argc; i++){
+    for(b = benches; b->name; b++)
+      if(strcmp(argv[i], b->name) == 0)
+        break;
+    if(b->name == 0){
+      printf(2, "fsbench: unknown benchmark %s\n", argv[i]);
+      exit();
+    }
+    b->fn();
+  }
+  exit();
+}
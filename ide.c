@@ -1,4 +1,6 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.  Uses bus-master DMA through the
+// PCI IDE controller if there is one, else programmed I/O,
+// which moves a block a sector per interrupt.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +14,9 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
+#include "iosched.h"
+#include "iostat.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -21,18 +26,47 @@
 
 #define IDE_CMD_READ  0x20
 #define IDE_CMD_WRITE 0x30
-#define IDE_CMD_RDMUL 0xc4
-#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_RDMA  0xc8
+#define IDE_CMD_WDMA  0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+// Bus-master IDE registers of the primary channel,
+// at I/O BAR 4 of the controller.
+#define BM_CMD        0     // command
+#define BM_STATUS     2     // status
+#define BM_PRDT       4     // physical address of PRD table
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // transfer from disk to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+#define IDE_MAXSECT   128   // most sectors in one DMA command
+
+// Physical region descriptor: a piece of memory for
+// a DMA transfer, which may not cross 64 KB.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last descriptor in the table
+
+// idequeue holds the bufs waiting to be read/written to the disk,
+// in the order chosen by the I/O scheduler.  ideactive lists,
+// linked by qnext, the bufs in the command in progress.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
-static struct buf *idequeue;
+static struct ioq idequeue;
+static struct buf *ideactive;
+static int idenbuf;
 
 static int havedisk1;
-static void idestart(struct buf*);
+static ushort bmbase;     // bus-master registers, or 0 for PIO
+static struct prd *prdt;  // one page
+static uint ncmd;         // commands started
+static uint nblk;         // blocks they transferred
+static int idesect;       // sectors of a PIO command moved
+static void idestart(void);
 
 // Wait for IDE disk to become ready.
 static int
@@ -50,6 +84,7 @@ idewait(int checkerr)
 void
 ideinit(void)
 {
+  struct pcidev *d;
   int i;
 
   initlock(&idelock, "ide");
@@ -67,78 +102,169 @@ ideinit(void)
 
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  // Use DMA if the IDE controller can be bus master.
+  d = pcifind(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, 0, 0);
+  if(d && (d->progif & 0x80) && (d->iobar & (1<<4)) &&
+     (prdt = (struct prd*)kalloc()) != 0){
+    pciwrite(d, PCI_CMD, pciread(d, PCI_CMD) | PCI_CMD_IO | PCI_CMD_MASTER);
+    bmbase = d->bar[4];
+  }
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start a DMA command for b and the queued bufs for the
+// following blocks in the same direction, up to IDE_MAXSECT
+// sectors.  Return the number of sectors.
+static int
+idedma(struct buf *b)
+{
+  struct buf *q;
+  int n, sector_per_block;
+
+  sector_per_block = BSIZE/SECTOR_SIZE;
+  n = 0;
+  for(q = b; ; q = q->qnext){
+    prdt[n].addr = V2P(q->data);
+    prdt[n].len = BSIZE;
+    prdt[n].flags = 0;
+    n++;
+    q->qnext = 0;
+    if((n+1)*sector_per_block > IDE_MAXSECT ||
+       (q->qnext = ioqnext(&idequeue, q)) == 0)
+      break;
+  }
+  prdt[n-1].flags = PRD_EOT;
+  idenbuf = n;
+
+  outl(bmbase+BM_PRDT, V2P(prdt));
+  outb(bmbase+BM_STATUS, BM_ST_ERR|BM_ST_INTR);  // clear
+  outb(bmbase+BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
+  return n*sector_per_block;
+}
+
+// Start the next queued request, merged with the requests
+// for the following blocks if using DMA.  Caller must hold idelock.
 static void
-idestart(struct buf *b)
+idestart(void)
 {
-  if(b == 0)
-    panic("idestart");
-  if(b->blockno >= FSSIZE)
+  struct buf *b;
+
+  if((b = ioqnext(&idequeue, 0)) == 0)
+    return;
+  ideactive = b;
+  b->qnext = 0;
+  // sb.size is 0 until the superblock has been read.
+  if(b->dev == ROOTDEV && sb.size && b->blockno >= sb.size)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
-  if (sector_per_block > 7) panic("idestart");
+  int nsect = sector_per_block;
+
+  idenbuf = 1;
+  idesect = 0;
+  if(bmbase)
+    nsect = idedma(b);
+  ncmd++;
+  nblk += idenbuf;
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsect);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+  if(bmbase){
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WDMA : IDE_CMD_RDMA);
+    outb(bmbase+BM_CMD, inb(bmbase+BM_CMD) | BM_CMD_START);
+  } else if(b->flags & B_DIRTY){
+    // The disk interrupts after each sector; ideintr
+    // writes the rest.
+    outb(0x1f7, IDE_CMD_WRITE);
+    outsl(0x1f0, b->data, SECTOR_SIZE/4);
   } else {
-    outb(0x1f7, read_cmd);
+    outb(0x1f7, IDE_CMD_READ);
   }
 }
 
+// Move the next sector of the PIO command for b after the
+// disk interrupts.  Return 1 if more sectors are to come.
+// Caller must hold idelock.
+static int
+idepio(struct buf *b)
+{
+  if(b->flags & B_DIRTY){
+    if(++idesect == BSIZE/SECTOR_SIZE)
+      return 0;
+    idewait(0);
+    outsl(0x1f0, b->data + idesect*SECTOR_SIZE, SECTOR_SIZE/4);
+    return 1;
+  }
+  if(idewait(1) >= 0)
+    insl(0x1f0, b->data + idesect*SECTOR_SIZE, SECTOR_SIZE/4);
+  return ++idesect < BSIZE/SECTOR_SIZE;
+}
+
 // Interrupt handler.
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *done;
+  int i;
 
-  // First queued buffer is the active request.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if(ideactive == 0){
+    release(&idelock);
+    return;
+  }
+  if(bmbase){
+    outb(bmbase+BM_CMD, 0);  // stop the transfer
+    if((inb(bmbase+BM_STATUS) & BM_ST_ERR) || idewait(1) < 0)
+      panic("ide: dma error");
+    outb(bmbase+BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+  } else if(idepio(ideactive)){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
-
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  done = 0;
+  for(i = 0; i < idenbuf; i++){
+    b = ideactive;
+    ideactive = b->qnext;
+    ioqdone(&idequeue, b);
 
+    // Wake process waiting for this buf.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    wakeup(b);
+    if(b->flags & B_ASYNC){
+      b->qnext = done;
+      done = b;
+    }
+  }
   // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  idestart();
 
   release(&idelock);
+
+  // Finish asynchronous requests without holding idelock.
+  while((b = done) != 0){
+    done = b->qnext;
+    biodone(b);
+  }
 }
 
 //PAGEBREAK!
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, return at once; ideintr calls biodone
+// when the request completes.
 void
 iderw(struct buf *b)
 {
-  struct buf **pp;
-
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -148,21 +274,30 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  ioqinsert(&idequeue, b);  //DOC:insert-queue
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(ideactive == 0)
+    idestart();
 
   // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
+  if((b->flags & B_ASYNC) == 0){
+    while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+      sleep(b, &idelock);
+    }
   }
 
 
   release(&idelock);
 }
+
+// Report disk statistics.
+void
+idestat(struct iostat *st)
+{
+  acquire(&idelock);
+  st->dcmds = ncmd;
+  st->dblocks = nblk;
+  ioqstat(&idequeue, st);
+  release(&idelock);
+}
@@ -73,3 +73,13 @@ ioapicenable(int irq, int cpunum)
   ioapicwrite(REG_TABLE+2*irq, T_IRQ0 + irq);
   ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
 }
+
+// Enable a PCI interrupt (INTx) line, which is level-triggered
+// and active low, unlike the ISA interrupts.  The device holds
+// the line asserted until its driver acknowledges it.
+void
+ioapicenablepci(int irq, int cpunum)
+{
+  ioapicwrite(REG_TABLE+2*irq, INT_LEVEL | INT_ACTIVELOW | (T_IRQ0 + irq));
+  ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+}
@@ -0,0 +1,181 @@
+// I/O scheduler: chooses the order in which a disk driver
+// starts its requests.
+//
+// Pending requests are kept on two lists.  The sorted list,
+// by device and block number, is served like an elevator that
+// only goes up (C-SCAN): from the position of the last request
+// started upward, then from the lowest request again.  The
+// list in arrival order gives each request a deadline; once
+// the oldest request has waited longer than that, it is
+// started next wherever it is, so requests far from a busy
+// region are not starved.  Reads get a shorter deadline than
+// writes, since a process is usually waiting for them.
+//
+// A driver that can transfer several blocks with one command
+// asks for the request after the one it is starting; since
+// the list is sorted, a request for the next block is there.
+//
+// Callers hold the driver's lock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "iosched.h"
+#include "iostat.h"
+
+#define DEADLINE_R  10   // ticks a read may wait for the elevator
+#define DEADLINE_W  50   // ticks a write may wait
+
+// Does a come before b in the sorted list?
+static int
+before(struct buf *a, struct buf *b)
+{
+  return a->dev < b->dev || (a->dev == b->dev && a->blockno < b->blockno);
+}
+
+// Is b at or past the elevator's position?
+static int
+ahead(struct ioq *q, struct buf *b)
+{
+  return b->dev > q->posdev ||
+    (b->dev == q->posdev && b->blockno >= q->posblock);
+}
+
+// Add request b to q.
+void
+ioqinsert(struct ioq *q, struct buf *b)
+{
+  struct buf *p;
+
+  b->qtime = ticks;
+  b->fnext = 0;
+  b->fprev = q->ftail;
+  if(q->ftail)
+    q->ftail->fnext = b;
+  else
+    q->fhead = b;
+  q->ftail = b;
+
+  // Find p, the last request before b.  Start from the
+  // last insert, so that sequential streams take O(1).
+  if(q->tail && before(q->tail, b))
+    p = q->tail;
+  else {
+    if(q->hint && before(q->hint, b))
+      p = q->hint;
+    else if(q->head && before(q->head, b))
+      p = q->head;
+    else
+      p = 0;
+    while(p && p->qnext && before(p->qnext, b))
+      p = p->qnext;
+  }
+  b->qprev = p;
+  b->qnext = p ? p->qnext : q->head;
+  if(b->qnext)
+    b->qnext->qprev = b;
+  else
+    q->tail = b;
+  if(p)
+    p->qnext = b;
+  else
+    q->head = b;
+  q->hint = b;
+
+  if(ahead(q, b) && (q->cursor == 0 || before(b, q->cursor)))
+    q->cursor = b;
+
+  q->depth++;
+  q->nreq++;
+  q->depthsum += q->depth;
+  if(q->depth > q->maxdepth)
+    q->maxdepth = q->depth;
+}
+
+// Remove b from both lists.
+static void
+ioqremove(struct ioq *q, struct buf *b)
+{
+  if(b->qprev)
+    b->qprev->qnext = b->qnext;
+  else
+    q->head = b->qnext;
+  if(b->qnext)
+    b->qnext->qprev = b->qprev;
+  else
+    q->tail = b->qprev;
+  if(q->hint == b)
+    q->hint = b->qprev;
+
+  if(b->fprev)
+    b->fprev->fnext = b->fnext;
+  else
+    q->fhead = b->fnext;
+  if(b->fnext)
+    b->fnext->fprev = b->fprev;
+  else
+    q->ftail = b->fprev;
+}
+
+// Remove and return the request to start next, or 0 if
+// there is none.  If prev is not 0, return only a request
+// that can join prev's command: for the next block, in the
+// same direction.
+struct buf*
+ioqnext(struct ioq *q, struct buf *prev)
+{
+  struct buf *b, *next;
+  int deadline;
+
+  if(prev){
+    b = q->cursor;
+    if(b == 0 || b->dev != prev->dev || b->blockno != prev->blockno+1 ||
+       (b->flags & B_DIRTY) != (prev->flags & B_DIRTY))
+      return 0;
+  } else {
+    if((b = q->fhead) == 0)
+      return 0;
+    deadline = (b->flags & B_DIRTY) ? DEADLINE_W : DEADLINE_R;
+    if(ticks - b->qtime > deadline)
+      q->nexpired++;
+    else
+      b = q->cursor ? q->cursor : q->head;
+  }
+  next = b->qnext;
+  ioqremove(q, b);
+  q->cursor = next;
+  q->posdev = b->dev;
+  q->posblock = b->blockno;
+  return b;
+}
+
+// Request b, returned by ioqnext, has completed.
+void
+ioqdone(struct ioq *q, struct buf *b)
+{
+  uint wait;
+
+  wait = ticks - b->qtime;
+  q->depth--;
+  q->waitsum += wait;
+  if(wait > q->maxwait)
+    q->maxwait = wait;
+}
+
+// Add q's statistics to st.
+void
+ioqstat(struct ioq *q, struct iostat *st)
+{
+  st->qreqs += q->nreq;
+  st->qdepthsum += q->depthsum;
+  st->qwaitsum += q->waitsum;
+  st->qexpired += q->nexpired;
+  if(q->maxdepth > st->qmaxdepth)
+    st->qmaxdepth = q->maxdepth;
+  if(q->maxwait > st->qmaxwait)
+    st->qmaxwait = q->maxwait;
+}
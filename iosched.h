@@ -0,0 +1,19 @@
+// Pending disk requests of one device, ordered by the
+// I/O scheduler (iosched.c).  Protected by the driver's lock.
+struct ioq {
+  struct buf *head;     // sorted by device and block number
+  struct buf *tail;
+  struct buf *cursor;   // next in elevator order; 0 means head
+  struct buf *hint;     // last inserted
+  struct buf *fhead;    // in arrival order
+  struct buf *ftail;
+  uint posdev;          // position of the last request started
+  uint posblock;
+  int depth;            // requests queued or in progress
+  uint nreq;            // statistics
+  uint depthsum;
+  uint maxdepth;
+  uint waitsum;
+  uint maxwait;
+  uint nexpired;
+};
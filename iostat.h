@@ -0,0 +1,33 @@
+// Block I/O statistics, reported by the iostat system call.
+struct iostat {
+  uint bhits;    // buffer cache lookups found in the cache
+  uint bmisses;  // buffer cache lookups that recycled a buffer
+  uint bevicts;  // cached blocks evicted to make room
+  uint nbuf;     // buffers in the cache
+  uint dcmds;    // disk commands
+  uint dblocks;  // blocks they transferred
+  uint qreqs;    // disk requests queued
+  uint qdepthsum;  // sum of queue depths seen by them on arrival
+  uint qmaxdepth;  // most requests queued or in progress at once
+  uint qwaitsum;   // sum of ticks from queueing to completion
+  uint qmaxwait;   // longest of those
+  uint qexpired;   // requests started early because of their deadline
+  uint ncommit;  // log transactions committed
+  uint nops;     // FS system calls in those transactions
+  uint cticks;   // ticks spent committing them
+  uint nckpt;    // log checkpoints
+  uint lwrites;  // blocks written to the log
+  uint labsorb;  // block writes absorbed into a logged block
+  uint lheads;   // log header writes
+  uint iwrites;  // blocks installed at their home locations
+  uint nalloc;   // blocks allocated
+  uint ascan;    // bitmap blocks read by balloc to find them
+  uint acycles;  // CPU cycles spent in balloc
+  uint freeblocks; // free blocks in the file system
+  uint fsblocks;   // blocks in the file system
+  uint ihits;    // inode cache lookups found in the cache
+  uint imisses;  // inode cache lookups that recycled an entry
+  uint ninode;   // inodes in the cache
+  uint dchits;   // path name lookups found in the dentry cache
+  uint dcmisses; // those that searched the directory
+};
@@ -5,135 +5,298 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 
-// Simple logging that allows concurrent FS system calls.
+// Logging that allows concurrent FS system calls, with group
+// commit and lazy checkpointing.
 //
-// A log transaction contains the updates of multiple FS system
-// calls. The logging system only commits when there are
-// no FS system calls active. Thus there is never
-// any reasoning required about whether a commit might
-// write an uncommitted system call's updates to disk.
+// A system call should call begin_op()/end_op() to mark its
+// start and end.  begin_op(n) reserves log space for the n
+// blocks the call may write, plus the free bitmap, and usually
+// returns at once; it sleeps while log.quiet or log.draining is
+// set, or while the reservations could run the log out of
+// space.  Between them, log_write() records each modified
+// block in log.block[] and pins it dirty in the buffer cache;
+// a block already recorded since the last commit is absorbed.
 //
-// A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// Group commit: a transaction holds the updates of every FS
+// system call that ended since the last one, and is committed
+// by the end_op() that leaves no call running, so no commit
+// writes an unfinished call's updates.  commit() sets
+// log.quiet only while it copies log.block[commitend..n) into
+// log buffers, then lets new calls start the next generation
+// while the copies are written; log.commitend marks where the
+// next transaction begins.  Calls that end meanwhile are
+// committed together as soon as the write finishes.  The log
+// size is chosen by mkfs and kept in the superblock.
 //
-// The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
-// Log appends are synchronous.
-
-// Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
-struct logheader {
-  int n;
-  int block[LOGSIZE];
+// The log is a physical re-do log of whole blocks, written
+// circularly.  The on-disk format:
+//   header block, containing the slot and sequence number
+//     of the first transaction recovery must replay
+//   slots, each holding either
+//     a descriptor block: DESCMAGIC, sequence number, block
+//       count, checksum and block #s for blocks A, B, C, ...
+//       of a transaction
+//     or one of the blocks that follow it: A, B, C, ...
+// Commit writes a transaction's descriptor and blocks all at
+// once; the transaction is committed when the last of those
+// writes completes.  Recovery replays transactions from the
+// header's slot for as long as the sequence numbers follow on
+// and the checksums match, so a partly written transaction is
+// ignored and nothing needs to be cleared.  So that recovery
+// can't take a logged block for a descriptor, a block that
+// begins with DESCMAGIC is logged with that word cleared and
+// LOGESCAPE set in its descriptor entry; replay puts it back.
+//
+// Lazy checkpoint: committed blocks stay dirty in the buffer
+// cache and are installed at their home locations later, by
+// checkpoint(), and a block changed by many transactions is
+// written home only once.  The flusher thread checkpoints when
+// no call is running and the committed blocks are CKPTAGE
+// ticks old or fill CKPTRATIO percent of the log.  Only when
+// the log is about to wrap onto uninstalled transactions does
+// commit() checkpoint itself and rewrite the header, moving
+// the tail up to the head.
+
+#define CKPTAGE   300  // flusher checkpoints blocks committed this many ticks ago
+#define CKPTRATIO 50   // ... or when they fill this percent of the log
+
+#define LOGMAGIC  0x6c6f6768  // header block
+#define DESCMAGIC 0x6c6f6764  // descriptor block
+#define LOGESCAPE 0x80000000  // in logdesc.block[]: first word was DESCMAGIC
+
+// Contents of the header block.
+struct loghead {
+  uint magic;
+  uint seq;    // sequence number of the first transaction to replay
+  uint tail;   // slot of its descriptor
+};
+
+// Contents of a descriptor block.
+struct logdesc {
+  uint magic;
+  uint seq;
+  uint n;
+  uint cksum;  // of seq, n, the n blocks and block[]
+  uint block[LOGSIZE];
 };
 
 struct log {
   struct spinlock lock;
-  int start;
+  int start;       // header block; the slots follow it
   int size;
+  int nslot;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int committing;  // in commit() or checkpoint().
+  int quiet;       // commit or checkpoint needs no FS sys calls; begin_op waits.
+  int draining;    // processes in log_force()/log_sync(); begin_op waits.
   int dev;
-  struct logheader lh;
+  int ncommitted;  // block[0..ncommitted) are committed, not yet installed.
+  int commitend;   // block[ncommitted..commitend) are being committed.
+  int genops;      // FS sys calls in the running generation.
+  int genreserve;  // log blocks they reserved.
+  int nbitmap;     // free bitmap blocks, reserved by every op.
+  int maxop;       // most blocks one op may reserve.
+  uint head;       // next slot to write (mod nslot)
+  uint tail;       // header's slot; [tail, head) may not be overwritten
+  uint seq;        // sequence number of the next transaction
+  uint committime; // ticks at the oldest commit not yet installed.
+  uint ncommit;    // statistics for iostat
+  uint nops;
+  uint cticks;
+  uint nckpt;
+  uint lwrites;
+  uint lheads;
+  uint iwrites;
+  uint labsorb;
+  int n;           // blocks logged and not yet installed
+  int block[LOGSIZE];  // their block numbers, in log order
 };
 struct log log;
 
+// Buffers being written by commit() or checkpoint(), which
+// log.committing allows only one process in at a time.
+static struct buf *lbuf[LOGSIZE+1], *dbuf[LOGSIZE];
+
 static void recover_from_log(void);
-static void commit();
+static void commit(void);
+static void checkpoint(void);
+static void flusher(void);
 
 void
 initlog(int dev)
 {
-  if (sizeof(struct logheader) >= BSIZE)
-    panic("initlog: too big logheader");
+  if (sizeof(struct logdesc) > BSIZE)
+    panic("initlog: too big logdesc");
 
   struct superblock sb;
   initlock(&log.lock, "log");
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
+  log.nslot = log.size - 1;
   log.dev = dev;
+  log.nbitmap = sb.size/BPB + 1;
+  log.maxop = log.nslot/2;
+  if(log.nslot > LOGSIZE || log.maxop < MAXOPBLOCKS + log.nbitmap)
+    panic("initlog: bad log size");
   recover_from_log();
+  if(kthread("flusher", flusher) < 0)
+    panic("initlog: flusher");
 }
 
-// Copy committed blocks from log to their home location
-static void
-install_trans(void)
+// Disk block of log slot s.
+static uint
+slot(uint s)
 {
-  int tail;
+  return log.start + 1 + s % log.nslot;
+}
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
-  }
+// Continue checksum sum over the n words at p.
+static uint
+cksum(uint sum, uint *p, int n)
+{
+  while(n-- > 0)
+    sum = ((sum << 5) | (sum >> 27)) + *p++;
+  return sum;
 }
 
-// Read the log header from disk into the in-memory log header
+// Copy committed blocks from the cache to their home
+// locations.  A block logged more than once is installed
+// once.  All the writes are in flight at once.
 static void
-read_head(void)
+install_trans(void)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
-  int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  int tail, i, n;
+
+  n = 0;
+  for (tail = 0; tail < log.ncommitted; tail++) {
+    for (i = tail+1; i < log.ncommitted; i++)
+      if (log.block[i] == log.block[tail])
+        break;
+    if (i < log.ncommitted)
+      continue;  // superseded by a later entry
+    dbuf[n] = bread(log.dev, log.block[tail]); // cached and dirty
+    bwrite_async(dbuf[n]);  // write dst to disk
+    n++;
   }
-  brelse(buf);
+  for (i = 0; i < n; i++) {
+    biowait(dbuf[i]);
+    brelse(dbuf[i]);
+  }
+  log.iwrites += n;
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write the in-memory log header to disk: recovery will
+// start at slot head.
 static void
 write_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
-  struct logheader *hb = (struct logheader *) (buf->data);
-  int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
-  }
+  struct loghead *hb = (struct loghead *) (buf->data);
+
+  hb->magic = LOGMAGIC;
+  hb->seq = log.seq;
+  hb->tail = log.head % log.nslot;
   bwrite(buf);
   brelse(buf);
+  log.tail = log.head;
+  log.lheads++;
+}
+
+// If the transaction at slot pos is numbered seq and was
+// completely written, copy its blocks to their home locations
+// and return how many there are.  Otherwise return -1.
+// All the log reads, and then all the writes, are in flight
+// at once; the home locations are overwritten without being read.
+static int
+replay(uint pos, uint seq)
+{
+  struct buf *db;
+  struct logdesc *d;
+  uint sum;
+  int i, n;
+
+  db = bread(log.dev, slot(pos));
+  d = (struct logdesc *) (db->data);
+  if (d->magic != DESCMAGIC || d->seq != seq || d->n >= log.nslot) {
+    brelse(db);
+    return -1;
+  }
+  n = d->n;
+  for (i = 0; i < n; i++)
+    lbuf[i] = bread_async(log.dev, slot(pos+1+i)); // read log block
+  sum = cksum(0, &d->seq, 2);
+  for (i = 0; i < n; i++) {
+    biowait(lbuf[i]);
+    sum = cksum(sum, (uint*)lbuf[i]->data, BSIZE/4);
+  }
+  sum = cksum(sum, d->block, n);
+  if (sum != d->cksum) {
+    for (i = 0; i < n; i++)
+      brelse(lbuf[i]);
+    brelse(db);
+    return -1;
+  }
+  for (i = 0; i < n; i++) {
+    dbuf[i] = bclaim(log.dev, d->block[i] & ~LOGESCAPE); // dst
+    memmove(dbuf[i]->data, lbuf[i]->data, BSIZE);  // copy block to dst
+    if (d->block[i] & LOGESCAPE)
+      *(uint*)dbuf[i]->data = DESCMAGIC;
+    bwrite_async(dbuf[i]);  // write dst to disk
+    brelse(lbuf[i]);
+  }
+  for (i = 0; i < n; i++) {
+    biowait(dbuf[i]);
+    brelse(dbuf[i]);
+  }
+  brelse(db);
+  return n;
 }
 
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  struct buf *buf = bread(log.dev, log.start);
+  struct loghead *lh = (struct loghead *) (buf->data);
+  int n;
+
+  log.head = 0;
+  log.seq = 1;
+  if (lh->magic == LOGMAGIC) {
+    log.head = lh->tail;
+    log.seq = lh->seq;
+  }
+  brelse(buf);
+
+  // replay the committed transactions in order
+  while ((n = replay(log.head, log.seq)) >= 0) {
+    log.head += n + 1;
+    log.seq++;
+  }
+  write_head(); // start the log after them
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call that
+// may write n blocks besides the free bitmap.
 void
-begin_op(void)
+begin_op(int n)
 {
   acquire(&log.lock);
+  n += log.nbitmap;
+  if(n > log.maxop)
+    panic("begin_op: too many blocks");
   while(1){
-    if(log.committing){
+    if(log.quiet || log.draining){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.head - log.tail + log.genreserve + n + 1 > log.nslot){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.genops += 1;
+      log.genreserve += n;
       release(&log.lock);
       break;
     }
@@ -141,66 +304,227 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// commits if this was the last outstanding operation
+// and no commit is already in progress.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
+  if(log.outstanding == 0 && !log.committing){
     log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+    commit();
+    log.committing = 0;
   }
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
   release(&log.lock);
+}
+
+// Write log entries [start, end) as transaction seq at slot pos:
+// copy the blocks from the cache to log buffers and start
+// writing them and their descriptor, lbuf[0].
+static void
+write_log(int start, int end, uint pos, uint seq)
+{
+  struct logdesc *d;
+  int i, n;
+
+  n = end - start;
+  for (i = 0; i <= n; i++)
+    lbuf[i] = bclaim(log.dev, slot(pos+i)); // log block
+  d = (struct logdesc *) (lbuf[0]->data);
+  memset(d, 0, BSIZE);
+  d->magic = DESCMAGIC;
+  d->seq = seq;
+  d->n = n;
+  d->cksum = cksum(0, &d->seq, 2);
+  for (i = 1; i <= n; i++) {
+    struct buf *from = bread(log.dev, log.block[start+i-1]); // cache block
+    memmove(lbuf[i]->data, from->data, BSIZE);
+    d->block[i-1] = log.block[start+i-1];
+    if (*(uint*)lbuf[i]->data == DESCMAGIC) {
+      *(uint*)lbuf[i]->data = 0;
+      d->block[i-1] |= LOGESCAPE;
+    }
+    d->cksum = cksum(d->cksum, (uint*)lbuf[i]->data, BSIZE/4);
+    bwrite_async(lbuf[i]);  // write the log
+    brelse(from);
+  }
+  d->cksum = cksum(d->cksum, d->block, n);
+  bwrite_async(lbuf[0]);
+}
+
+// Commit generations until no FS system call has finished
+// uncommitted.  Called by the end_op() that left none running,
+// holding log.lock with log.committing set; releases the lock
+// while it writes, and returns holding it.
+static void
+commit(void)
+{
+  int start, end, i;
+  uint pos, seq, t0;
+
+  while(log.outstanding == 0 && log.n > log.commitend){
+    start = log.commitend;
+    end = log.n;
+    pos = log.head;
+    seq = log.seq++;
+    log.head += end - start + 1;
+    log.quiet = 1;
+    log.nops += log.genops;
+    log.genops = 0;
+    log.genreserve = 0;
+    release(&log.lock);
+
+    t0 = ticks;
+    write_log(start, end, pos, seq); // Copy modified blocks from cache to log
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
     acquire(&log.lock);
-    log.committing = 0;
+    log.commitend = end;
+    log.quiet = 0;
+    wakeup(&log);  // the next generation may start
+    release(&log.lock);
+
+    for (i = 0; i <= end - start; i++) { // the real commit
+      biowait(lbuf[i]);
+      brelse(lbuf[i]);
+    }
+
+    acquire(&log.lock);
+    if (log.ncommitted == 0)
+      log.committime = ticks;
+    log.ncommitted = end;
+    log.ncommit++;
+    log.lwrites += end - start + 1;
+    log.cticks += ticks - t0;
     wakeup(&log);
+  }
+
+  if(log.outstanding > 0)
+    return;
+  log.genreserve = 0;  // the generation wrote nothing
+  // The next operation must have room.  Install what the
+  // flusher has not, and let the log wrap around.
+  if(log.nslot - (log.head - log.tail) < log.maxop + 1){
+    log.quiet = 1;
     release(&log.lock);
+    checkpoint();
+    write_head();
+    acquire(&log.lock);
+    log.quiet = 0;
   }
 }
 
-// Copy modified blocks from cache to log.
+// Install the committed blocks, so that the log space they
+// use may be reused.  Called with log.committing and log.quiet
+// set, when no FS system call is running and all are committed.
 static void
-write_log(void)
+checkpoint(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
-  }
+  if (log.n == 0)
+    return;
+  install_trans(); // Now install writes to home locations
+  acquire(&log.lock);
+  log.n = 0;
+  log.ncommitted = 0;
+  log.commitend = 0;
+  log.nckpt++;
+  release(&log.lock);
 }
 
+// Log flusher thread.  Checks the log every clock tick and
+// checkpoints it when no FS system call is running and the
+// committed blocks are old or numerous enough.  Also has the
+// buffer cache give back memory when free memory is low.
 static void
-commit()
+flusher(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  for(;;){
+    acquire(&tickslock);
+    sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    acquire(&log.lock);
+    if(log.ncommitted > 0 && log.outstanding == 0 && !log.committing &&
+       (ticks - log.committime >= CKPTAGE ||
+        log.ncommitted*100 >= log.nslot*CKPTRATIO)){
+      log.committing = 1;
+      log.quiet = 1;
+      release(&log.lock);
+      checkpoint();
+      acquire(&log.lock);
+      log.committing = 0;
+      log.quiet = 0;
+      wakeup(&log);
+    }
+    release(&log.lock);
+
+    breclaim();
   }
 }
 
+// Wait until every FS system call that has completed is
+// committed, and so will survive a crash.
+void
+log_force(void)
+{
+  acquire(&log.lock);
+  log.draining++;
+  while(log.n > log.ncommitted || log.committing)
+    sleep(&log, &log.lock);
+  log.draining--;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Commit, then install every committed block at its home
+// location.
+void
+log_sync(void)
+{
+  acquire(&log.lock);
+  log.draining++;
+  while(log.outstanding > 0 || log.committing)
+    sleep(&log, &log.lock);
+  log.draining--;
+  log.committing = 1;
+  log.quiet = 1;
+  release(&log.lock);
+  checkpoint();
+  acquire(&log.lock);
+  log.committing = 0;
+  log.quiet = 0;
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Most blocks one operation may write, not counting
+// the free bitmap.
+int
+log_maxop(void)
+{
+  return log.maxop - log.nbitmap;
+}
+
+// Report log statistics.
+void
+logstat(struct iostat *st)
+{
+  acquire(&log.lock);
+  st->ncommit = log.ncommit;
+  st->nops = log.nops;
+  st->cticks = log.cticks;
+  st->nckpt = log.nckpt;
+  st->lwrites = log.lwrites;
+  st->lheads = log.lheads;
+  st->iwrites = log.iwrites;
+  st->labsorb = log.labsorb;
+  release(&log.lock);
+}
+
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
 // commit()/write_log() will do the disk write.
@@ -215,20 +539,21 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.n >= log.nslot - 1)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
+  for (i = log.commitend; i < log.n; i++) {
+    if (log.block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
-    log.lh.n++;
+  log.block[i] = b->blockno;
+  if (i == log.n)
+    log.n++;
+  else
+    log.labsorb++;
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
-
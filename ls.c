@@ -22,12 +22,14 @@ fmtname(char *path)
   return buf;
 }
 
+#define NENT 64  // entries per getdents call
+
+struct gdent ents[NENT];
+
 void
 ls(char *path)
 {
-  char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, i, n;
   struct stat st;
 
   if((fd = open(path, 0)) < 0){
@@ -47,24 +49,12 @@ ls(char *path)
     break;
 
   case T_DIR:
-    if(strlen(path) + 1 + DIRSIZ + 1 > sizeof buf){
-      printf(1, "ls: path too long\n");
-      break;
-    }
-    strcpy(buf, path);
-    p = buf+strlen(buf);
-    *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf(1, "ls: cannot stat %s\n", buf);
-        continue;
-      }
-      printf(1, "%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
-    }
+    while((n = getdents(fd, ents, NENT, GD_STAT)) > 0)
+      for(i = 0; i < n; i++)
+        printf(1, "%s %d %d %d\n", fmtname(ents[i].name), ents[i].type,
+               ents[i].ino, ents[i].size);
+    if(n < 0)
+      printf(2, "ls: cannot read %s\n", path);
     break;
   }
   close(fd);
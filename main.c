@@ -30,7 +30,10 @@ main(void)
   tvinit();        // trap vectors
   binit();         // buffer cache
   fileinit();      // file table
+  mmapinit();      // cache of mapped file pages
+  pciinit();       // PCI devices
   ideinit();       // disk 
+  virtioinit();    // virtio disk, if any
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
   userinit();      // first user process
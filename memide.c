@@ -12,11 +12,13 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "iostat.h"
 
 extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
 
 static int disksize;
 static uchar *memdisk;
+static uint nblk;
 
 void
 ideinit(void)
@@ -35,6 +37,7 @@ ideintr(void)
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// If B_ASYNC is set, call biodone afterward.
 void
 iderw(struct buf *b)
 {
@@ -57,4 +60,15 @@ iderw(struct buf *b)
   } else
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
+  nblk++;
+  if(b->flags & B_ASYNC)
+    biodone(b);
+}
+
+// Report disk statistics.
+void
+idestat(struct iostat *st)
+{
+  st->dcmds = nblk;
+  st->dblocks = nblk;
 }
@@ -15,22 +15,23 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
-
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE+1;  // header and data blocks; mkfs -l to change
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
+int extents;  // files use extents; mkfs -e
 
 int fsfd;
 struct superblock sb;
 char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+struct dirent rootde[NINODES];  // root directory entries
+int nrootde;
 
 
 void balloc(int);
@@ -40,6 +41,8 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+uint eappend(struct dinode *din, uint fbn);
+void wdir(uint inum, struct dirent *de, int n);
 
 // convert to intel byte order
 ushort
@@ -68,19 +71,38 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
+  struct dirent *de;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  for(;;){
+    if(argc >= 3 && strcmp(argv[1], "-l") == 0){
+      nlog = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    } else if(argc >= 2 && strcmp(argv[1], "-e") == 0){
+      extents = 1;
+      argc--;
+      argv++;
+    } else
+      break;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l nlog] [-e] fs.img files...\n");
+    exit(1);
+  }
+  // The kernel lets an FS op reserve up to half the log,
+  // and each reserves room for the whole bitmap besides.
+  if(nlog-1 > LOGSIZE || (nlog-1)/2 < MAXOPBLOCKS + nbitmap){
+    fprintf(stderr, "mkfs: log size must be between %d and %d\n",
+            2*(MAXOPBLOCKS+nbitmap)+1, LOGSIZE+1);
     exit(1);
   }
 
+  assert(BSIZE >= 512 && BSIZE <= 4096 && (BSIZE & (BSIZE-1)) == 0);
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
@@ -90,7 +112,7 @@ main(int argc, char *argv[])
     exit(1);
   }
 
-  // 1 fs block = 1 disk sector
+  // 1 fs block = BSIZE/512 disk sectors
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
 
@@ -101,7 +123,10 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.bsize = xint(BSIZE);
+  sb.flags = xint(extents ? SB_EXTENTS : 0);
 
+  printf("block size %d\n", BSIZE);
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
 
@@ -117,15 +142,13 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
+  de = &rootde[nrootde++];
+  de->inum = xshort(rootino);
+  strcpy(de->name, ".");
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  de = &rootde[nrootde++];
+  de->inum = xshort(rootino);
+  strcpy(de->name, "..");
 
   for(i = 2; i < argc; i++){
     assert(index(argv[i], '/') == 0);
@@ -142,12 +165,11 @@ main(int argc, char *argv[])
     if(argv[i][0] == '_')
       ++argv[i];
 
-    inum = ialloc(T_FILE);
+    inum = ialloc(extents ? T_FILE|I_EXTENT : T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, argv[i], DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    de = &rootde[nrootde++];
+    de->inum = xshort(inum);
+    strncpy(de->name, argv[i], DIRSIZ);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -155,12 +177,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  wdir(rootino, rootde, nrootde);
 
   balloc(freeblock);
 
@@ -252,6 +269,32 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block holding block fbn of extent-mapped din,
+// which is the first block not yet mapped if it is not mapped.
+// Files are written in one piece, so each is a single extent.
+uint
+eappend(struct dinode *din, uint fbn)
+{
+  struct extent *ex;
+  uint i, len;
+
+  ex = (struct extent*)din->addrs;
+  for(i = 0; i < NEXTENT && (len = xint(ex[i].len)) != 0; i++){
+    if(fbn < len)
+      return xint(ex[i].start) + fbn;
+    fbn -= len;
+  }
+  assert(fbn == 0);
+  if(i > 0 && xint(ex[i-1].start) + xint(ex[i-1].len) == freeblock){
+    ex[i-1].len = xint(xint(ex[i-1].len) + 1);
+  } else {
+    assert(i < NEXTENT);
+    ex[i].start = xint(freeblock);
+    ex[i].len = xint(1);
+  }
+  return freeblock++;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -260,7 +303,7 @@ iappend(uint inum, void *xp, int n)
   struct dinode din;
   char buf[BSIZE];
   uint indirect[NINDIRECT];
-  uint x;
+  uint x, ind, i;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -268,21 +311,39 @@ iappend(uint inum, void *xp, int n)
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
+    if(xshort(din.type) & I_EXTENT){
+      x = eappend(&din, fbn);
+    } else if(fbn < NDIRECT){
       if(xint(din.addrs[fbn]) == 0){
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
+      if(fbn < NDIRECT + NINDIRECT){
+        if(xint(din.addrs[NDIRECT]) == 0){
+          din.addrs[NDIRECT] = xint(freeblock++);
+        }
+        ind = xint(din.addrs[NDIRECT]);
+        i = fbn - NDIRECT;
+      } else {
+        if(xint(din.addrs[NDIRECT+1]) == 0){
+          din.addrs[NDIRECT+1] = xint(freeblock++);
+        }
+        i = fbn - NDIRECT - NINDIRECT;
+        rsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+        if(indirect[i / NINDIRECT] == 0){
+          indirect[i / NINDIRECT] = xint(freeblock++);
+          wsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+        }
+        ind = xint(indirect[i / NINDIRECT]);
+        i %= NINDIRECT;
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      rsect(ind, (char*)indirect);
+      if(indirect[i] == 0){
+        indirect[i] = xint(freeblock++);
+        wsect(ind, (char*)indirect);
       }
-      x = xint(indirect[fbn-NDIRECT]);
+      x = xint(indirect[i]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -295,3 +356,139 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Directory blocks for wdir, and the number in use.
+char dblk[256][BSIZE];
+int ndblk;
+
+// FNV-1a hash of a directory entry name, as in fs.c.
+uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619;
+  return h;
+}
+
+ushort*
+dirtab(uint i)
+{
+  return (ushort*)((struct dirent*)dblk[0] + DTSLOT + i/DTPS) + 1 + i%DTPS;
+}
+
+struct bkthdr*
+bkthdr(uint bn)
+{
+  return (struct bkthdr*)dblk[bn];
+}
+
+uint
+newdblk(ushort depth)
+{
+  assert(ndblk < sizeof(dblk) / BSIZE);
+  bkthdr(ndblk)->depth = xshort(depth);
+  return ndblk++;
+}
+
+// Split bucket bn of the hashed directory in dblk by one
+// more bit of the hash.
+void
+dsplit(uint bn)
+{
+  struct dirhdr *dh;
+  struct dirent *de, *nde;
+  uint bit, i, j, nbn, depth;
+
+  dh = (struct dirhdr*)((struct dirent*)dblk[0] + 2);
+  depth = xshort(bkthdr(bn)->depth);
+  bit = 1 << depth;
+  if(depth == xshort(dh->depth)){
+    for(i = 0; i < bit; i++)
+      *dirtab(i + bit) = *dirtab(i);
+    dh->depth = xshort(depth + 1);
+  }
+  nbn = newdblk(depth + 1);
+  bkthdr(bn)->depth = xshort(depth + 1);
+  for(i = 0; i < (1 << xshort(dh->depth)); i++)
+    if(xshort(*dirtab(i)) == bn && (i & bit))
+      *dirtab(i) = xshort(nbn);
+
+  de = (struct dirent*)dblk[bn];
+  nde = (struct dirent*)dblk[nbn];
+  j = 1;
+  for(i = 1; i < DPB; i++){
+    if(dirhash(de[i].name) & bit){
+      nde[j++] = de[i];
+      bzero(&de[i], sizeof(de[i]));
+    }
+  }
+}
+
+// Add de to the hashed directory in dblk, splitting buckets
+// as long as that makes room, as dirlink in fs.c would.
+void
+dinsert(struct dirent *de)
+{
+  struct dirhdr *dh;
+  struct dirent *bde;
+  uint h, bn, first, i, depth;
+
+  dh = (struct dirhdr*)((struct dirent*)dblk[0] + 2);
+  h = dirhash(de->name);
+  for(;;){
+    first = bn = xshort(*dirtab(h & ((1 << xshort(dh->depth)) - 1)));
+    for(;;){
+      bde = (struct dirent*)dblk[bn];
+      for(i = 1; i < DPB; i++){
+        if(bde[i].inum == 0){
+          bde[i] = *de;
+          return;
+        }
+      }
+      if(bkthdr(bn)->next == 0)
+        break;
+      bn = xint(bkthdr(bn)->next);
+    }
+    depth = xshort(bkthdr(bn)->depth);
+    if(bn != first || (depth == xshort(dh->depth) && (2 << depth) > DTMAX))
+      break;
+    dsplit(bn);
+  }
+  bkthdr(bn)->next = xint(newdblk(depth));
+  ((struct dirent*)dblk[xint(bkthdr(bn)->next)])[1] = *de;
+}
+
+// Write the n entries de[], the first two "." and "..", as the
+// content of directory inum: as they are if they fit in a
+// block, otherwise in the hashed format of fs.h.
+void
+wdir(uint inum, struct dirent *de, int n)
+{
+  struct dirhdr *dh;
+  struct dinode din;
+  int i;
+
+  bzero(dblk, sizeof(dblk));
+  if(n <= DPB){
+    memmove(dblk[0], de, n*sizeof(*de));
+    iappend(inum, dblk[0], BSIZE);
+    return;
+  }
+
+  memmove(dblk[0], de, 2*sizeof(*de));
+  dh = (struct dirhdr*)((struct dirent*)dblk[0] + 2);
+  dh->magic = xshort(DIRMAGIC);
+  ndblk = 1;
+  *dirtab(0) = xshort(newdblk(0));
+  for(i = 2; i < n; i++)
+    dinsert(&de[i]);
+  iappend(inum, dblk, ndblk*BSIZE);
+
+  rinode(inum, &din);
+  din.type = xshort(xshort(din.type) | I_HASHDIR);
+  winode(inum, &din);
+}
@@ -0,0 +1,559 @@
+//
+// Memory-mapped files and anonymous memory.
+//
+// Each process has up to NVMA mappings, recorded in p->vma.
+// Mappings are placed top-down from KERNBASE, above the heap,
+// and their pages are loaded on first touch by mmapfault().
+//
+// The pages of a MAP_SHARED file mapping, or of a file mapping
+// that can't be written, come from a cache of file pages,
+// mcache, shared by every process that maps them: all map the
+// same physical page, which fork shares too.  readi() and
+// writei() consult the cache, so read() sees stores through a
+// mapping and a mapping sees write()s.  When the last mapping
+// of a page goes away, the page is written back to the file
+// through the log if any mapping dirtied it, and then freed.
+//
+// Pages of a writable MAP_PRIVATE file mapping or of anonymous
+// memory belong to the process: a file page is read from the
+// inode, an anonymous page is zeroed, and fork copies them.
+//
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "fcntl.h"
+#include "uio.h"
+
+// A page of a file, cached for mappings.
+struct mpage {
+  struct inode *ip;    // the file, with a reference
+  uint off;            // offset of the page in it
+  char *mem;
+  int ref;             // page table entries that map it
+  int dirty;           // stored to through a mapping
+  int busy;            // being written back and freed
+  struct mpage *next;  // hash chain, or free list
+};
+
+#define NMHASH 61
+#define MPP (PGSIZE / sizeof(struct mpage))  // mpages per page
+
+struct {
+  struct spinlock lock;
+  struct mpage *hash[NMHASH];
+  struct mpage *free;  // unused mpages, from kalloc a page at a time
+} mcache;
+
+#define MHASH(ip, off) (((uint)(ip) / sizeof(struct inode) + (off) / PGSIZE) % NMHASH)
+
+void
+mmapinit(void)
+{
+  initlock(&mcache.lock, "mcache");
+}
+
+// Find the cached page at off of ip.
+// Caller must hold mcache.lock.
+static struct mpage*
+mpfind(struct inode *ip, uint off)
+{
+  struct mpage *mp;
+
+  for(mp = mcache.hash[MHASH(ip, off)]; mp; mp = mp->next)
+    if(mp->ip == ip && mp->off == off)
+      return mp;
+  return 0;
+}
+
+// Remove mp from its hash chain.
+// Caller must hold mcache.lock.
+static void
+mpunhash(struct mpage *mp)
+{
+  struct mpage **pp;
+
+  for(pp = &mcache.hash[MHASH(mp->ip, mp->off)]; *pp != mp; pp = &(*pp)->next)
+    ;
+  *pp = mp->next;
+}
+
+// Allocate an mpage.
+// Caller must hold mcache.lock.
+static struct mpage*
+mpalloc(void)
+{
+  struct mpage *mp;
+  char *mem;
+  int i;
+
+  if(mcache.free == 0){
+    if((mem = kalloc()) == 0)
+      return 0;
+    memset(mem, 0, PGSIZE);
+    for(i = 0; i < MPP; i++){
+      mp = (struct mpage*)mem + i;
+      mp->next = mcache.free;
+      mcache.free = mp;
+    }
+  }
+  mp = mcache.free;
+  mcache.free = mp->next;
+  return mp;
+}
+
+// Return the cached page at off of ip with a new reference,
+// reading it from the file if it is not cached.  Return 0 if
+// there is no memory.
+static struct mpage*
+mpget(struct inode *ip, uint off)
+{
+  struct mpage *mp;
+  char *mem;
+
+  mem = 0;
+  for(;;){
+    acquire(&mcache.lock);
+    while((mp = mpfind(ip, off)) != 0 && mp->busy)
+      sleep(mp, &mcache.lock);
+    if(mp){
+      mp->ref++;
+      release(&mcache.lock);
+      if(mem)
+        kfree(mem);
+      return mp;
+    }
+    release(&mcache.lock);
+
+    if(mem == 0 && (mem = kalloc()) == 0)
+      return 0;
+    // Read and cache the page holding ip's lock, so that no
+    // write to the file comes between, and no other process
+    // caches or frees a page of ip meanwhile.
+    ilock(ip);
+    acquire(&mcache.lock);
+    mp = mpfind(ip, off);
+    release(&mcache.lock);
+    if(mp == 0)
+      break;
+    iunlock(ip);  // cached meanwhile; take that one
+  }
+
+  // Past the end of the file the page stays zero.
+  memset(mem, 0, PGSIZE);
+  readi(ip, mem, off, PGSIZE);
+  acquire(&mcache.lock);
+  if((mp = mpalloc()) == 0){
+    release(&mcache.lock);
+    iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+  mp->ip = ip;
+  mp->off = off;
+  mp->mem = mem;
+  mp->ref = 1;
+  mp->dirty = 0;
+  mp->busy = 0;
+  mp->next = mcache.hash[MHASH(ip, off)];
+  mcache.hash[MHASH(ip, off)] = mp;
+  release(&mcache.lock);
+  idup(ip);
+  ip->nmpage++;
+  iunlock(ip);
+  return mp;
+}
+
+// Return the cached page at off of ip, which a mapping holds.
+static struct mpage*
+mplookup(struct inode *ip, uint off)
+{
+  struct mpage *mp;
+
+  acquire(&mcache.lock);
+  mp = mpfind(ip, off);
+  release(&mcache.lock);
+  if(mp == 0)
+    panic("mplookup");
+  return mp;
+}
+
+// Drop a mapping's reference to mp, noting whether the mapping
+// dirtied it.  After the last, write the page back if it is
+// dirty and free it.
+static void
+mpput(struct mpage *mp, int dirty)
+{
+  struct inode *ip;
+  struct iovec iov;
+  uint off;
+
+  acquire(&mcache.lock);
+  if(dirty)
+    mp->dirty = 1;
+  if(--mp->ref > 0){
+    release(&mcache.lock);
+    return;
+  }
+  mp->busy = 1;  // mpget waits rather than map it again
+  release(&mcache.lock);
+
+  ip = mp->ip;
+  if(mp->dirty){
+    // Write only what lies inside the file; the rest of the
+    // page is not part of it.
+    ilock(ip);
+    iov.len = 0;
+    if(ip->size > mp->off)
+      iov.len = ip->size - mp->off < PGSIZE ? ip->size - mp->off : PGSIZE;
+    iunlock(ip);
+    iov.base = mp->mem;
+    off = mp->off;
+    if(iov.len > 0)
+      writeinode(ip, &iov, 1, &off);
+  }
+
+  ilock(ip);
+  acquire(&mcache.lock);
+  mpunhash(mp);
+  release(&mcache.lock);
+  ip->nmpage--;
+  iunlock(ip);
+
+  kfree(mp->mem);
+  acquire(&mcache.lock);
+  mp->ip = 0;
+  mp->next = mcache.free;
+  mcache.free = mp;
+  wakeup(mp);
+  release(&mcache.lock);
+
+  begin_op(IPUTBLOCKS);
+  iput(ip);
+  end_op();
+}
+
+// Copy the cached pages of ip in [off, off+n) over dst, which
+// readi() has filled from the file.
+// Caller must hold ip->lock.
+void
+mmapread(struct inode *ip, char *dst, uint off, uint n)
+{
+  struct mpage *mp;
+  uint a, lo, hi;
+
+  acquire(&mcache.lock);
+  for(a = PGROUNDDOWN(off); a < off + n; a += PGSIZE){
+    if((mp = mpfind(ip, a)) == 0)
+      continue;
+    lo = a > off ? a : off;
+    hi = a + PGSIZE < off + n ? a + PGSIZE : off + n;
+    memmove(dst + (lo - off), mp->mem + (lo - a), hi - lo);
+  }
+  release(&mcache.lock);
+}
+
+// Copy the n bytes that writei() wrote at off of ip from src
+// into the cached pages they fall in.
+// Caller must hold ip->lock.
+void
+mmapwrite(struct inode *ip, char *src, uint off, uint n)
+{
+  struct mpage *mp;
+  uint a, lo, hi;
+
+  acquire(&mcache.lock);
+  for(a = PGROUNDDOWN(off); a < off + n; a += PGSIZE){
+    if((mp = mpfind(ip, a)) == 0)
+      continue;
+    lo = a > off ? a : off;
+    hi = a + PGSIZE < off + n ? a + PGSIZE : off + n;
+    memmove(mp->mem + (lo - a), src + (lo - off), hi - lo);
+  }
+  release(&mcache.lock);
+}
+
+// Do the pages of v come from mcache?
+static int
+vmashared(struct vma *v)
+{
+  return v->f && ((v->flags & MAP_SHARED) || !(v->prot & PROT_WRITE));
+}
+
+// Return the mapping of p containing va, or 0.
+static struct vma*
+vmafind(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && va >= v->addr && va < v->addr + v->len)
+      return v;
+  return 0;
+}
+
+// Lowest address mapped in p, or KERNBASE.
+uint
+mmapbase(struct proc *p)
+{
+  struct vma *v;
+  uint base;
+
+  base = KERNBASE;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && v->addr < base)
+      base = v->addr;
+  return base;
+}
+
+// Find the highest len bytes of free address space in p
+// above its heap.  Return 0 if there are none.
+static uint
+vmaplace(struct proc *p, uint len)
+{
+  struct vma *v;
+  uint a;
+
+  a = KERNBASE - len;
+  for(;;){
+    if(a < PGROUNDUP(p->sz) || a > KERNBASE - len)
+      return 0;
+    for(v = p->vma; v < &p->vma[NVMA]; v++)
+      if(v->len && a < v->addr + v->len && v->addr < a + len)
+        break;
+    if(v == &p->vma[NVMA])
+      return a;
+    a = v->addr - len;
+  }
+}
+
+// Map len bytes of f starting at off, or anonymous memory if f
+// is 0, into the current process.  Return the address, or -1.
+// Takes a new reference to f.
+int
+mmap(uint len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+  uint a;
+
+  len = PGROUNDUP(len);
+  if(len == 0 || len >= KERNBASE || off % PGSIZE)
+    return -1;
+  for(v = curproc->vma; v < &curproc->vma[NVMA]; v++)
+    if(v->len == 0)
+      break;
+  if(v == &curproc->vma[NVMA] || (a = vmaplace(curproc, len)) == 0)
+    return -1;
+  v->addr = a;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->f = f ? filedup(f) : 0;
+  v->off = off;
+  return a;
+}
+
+// Unmap the pages from va to va+len of mapping v in p.  A page
+// from mcache is released, noting whether p dirtied it; the
+// others are freed.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint va, uint len)
+{
+  pte_t *pte;
+  uint a;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    if(vmashared(v))
+      mpput(mplookup(v->f->ip, v->off + (a - v->addr)), *pte & PTE_D);
+    else
+      kfree(P2V(PTE_ADDR(*pte)));
+    *pte = 0;
+  }
+  lcr3(V2P(p->pgdir));
+}
+
+// Unmap len bytes at addr from the current process.  The range
+// must be at the start or end of one mapping, or all of it.
+int
+munmap(uint addr, uint len)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+
+  len = PGROUNDUP(len);
+  if(addr % PGSIZE || len == 0 || (v = vmafind(curproc, addr)) == 0 ||
+     addr + len > v->addr + v->len)
+    return -1;
+  if(addr != v->addr && addr + len != v->addr + v->len)
+    return -1;  // would leave a hole
+
+  vmaunmap(curproc, v, addr, len);
+  if(addr == v->addr){
+    v->addr += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0 && v->f){
+    fileclose(v->f);
+    v->f = 0;
+  }
+  return 0;
+}
+
+// Unmap all of p's mappings, as exit and exec do.
+void
+mmapexit(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    vmaunmap(p, v, v->addr, v->len);
+    if(v->f)
+      fileclose(v->f);
+    v->f = 0;
+    v->len = 0;
+  }
+}
+
+// Give np, a new process, p's mappings: the same pages from
+// mcache and copies of the others.  np's page table must
+// already exist.
+int
+mmapfork(struct proc *np, struct proc *p)
+{
+  struct vma *v;
+  struct mpage *mp;
+  pte_t *pte;
+  uint a;
+  char *mem;
+
+  memmove(np->vma, p->vma, sizeof(p->vma));
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walkpgdir(p->pgdir, (char*)a, 0)) == 0 || !(*pte & PTE_P))
+        continue;
+      if(vmashared(v)){
+        mp = mplookup(v->f->ip, v->off + (a - v->addr));
+        if(mappages(np->pgdir, (char*)a, PGSIZE, PTE_ADDR(*pte),
+                    PTE_FLAGS(*pte) & ~PTE_D) < 0)
+          goto bad;
+        acquire(&mcache.lock);
+        mp->ref++;
+        release(&mcache.lock);
+        continue;
+      }
+      if((mem = kalloc()) == 0)
+        goto bad;
+      memmove(mem, P2V(PTE_ADDR(*pte)), PGSIZE);
+      if(mappages(np->pgdir, (char*)a, PGSIZE, V2P(mem), PTE_FLAGS(*pte)) < 0){
+        kfree(mem);
+        goto bad;
+      }
+    }
+  }
+  for(v = np->vma; v < &np->vma[NVMA]; v++)
+    if(v->len && v->f)
+      filedup(v->f);
+  return 0;
+
+bad:
+  // Give back the mcache pages np maps; freevm() frees the rest.
+  for(v = np->vma; v < &np->vma[NVMA]; v++){
+    if(v->len == 0 || !vmashared(v))
+      continue;
+    for(a = v->addr; a < v->addr + v->len; a += PGSIZE){
+      if((pte = walkpgdir(np->pgdir, (char*)a, 0)) == 0 || !(*pte & PTE_P))
+        continue;
+      mpput(mplookup(v->f->ip, v->off + (a - v->addr)), 0);
+      *pte = 0;
+    }
+  }
+  memset(np->vma, 0, sizeof(np->vma));
+  return -1;
+}
+
+// Load the page at va of the current process on a page fault.
+// Return -1 if va is not mapped or the access is not allowed.
+int
+mmapfault(uint va, int write)
+{
+  struct proc *curproc = myproc();
+  struct vma *v;
+  struct mpage *mp;
+  pte_t *pte;
+  char *mem;
+  uint a;
+  int perm;
+
+  if((v = vmafind(curproc, va)) == 0 || !(v->prot & PROT_READ))
+    return -1;
+  if(write && !(v->prot & PROT_WRITE))
+    return -1;
+  a = PGROUNDDOWN(va);
+  if((pte = walkpgdir(curproc->pgdir, (char*)a, 0)) != 0 && (*pte & PTE_P))
+    return -1;  // a protection fault on a loaded page
+
+  perm = PTE_U | ((v->prot & PROT_WRITE) ? PTE_W : 0);
+  if(vmashared(v)){
+    if((mp = mpget(v->f->ip, v->off + (a - v->addr))) == 0)
+      return -1;
+    if(mappages(curproc->pgdir, (char*)a, PGSIZE, V2P(mp->mem), perm) < 0){
+      mpput(mp, 0);
+      return -1;
+    }
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(v->f){
+    // Past the end of the file the page stays zero.
+    ilock(v->f->ip);
+    readi(v->f->ip, mem, v->off + (a - v->addr), PGSIZE);
+    iunlock(v->f->ip);
+  }
+  if(mappages(curproc->pgdir, (char*)a, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Check that the n bytes at va lie in one mapping of the
+// current process that allows the kernel to write them if
+// write is set, or to read them, and load their pages so that
+// the kernel can use them without faulting.
+int
+mmapcheck(uint va, uint n, int write)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint a;
+
+  if((v = vmafind(myproc(), va)) == 0 || n > v->addr + v->len - va)
+    return -1;
+  if(write && !(v->prot & PROT_WRITE))
+    return -1;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = walkpgdir(myproc()->pgdir, (char*)a, 0);
+    if((pte == 0 || !(*pte & PTE_P)) && mmapfault(a, write) < 0)
+      return -1;
+  }
+  return 0;
+}
@@ -1,14 +1,22 @@
 #define NPROC        64  // maximum number of processes
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
-#define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NOFILE       16  // initial size of a process's descriptor table
+#define NOFILEMAX  1024  // maximum open files per process
+#define NFILE      8192  // default limit on open files per system
+#define NVMA         16  // memory mappings per process
+#define NINODE       50  // i-nodes cached before recycling unused ones
+#define NINODEMAX  1024  // maximum number of cached i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXOPBLOCKS  10  // max # of blocks an FS op other than write writes
+#define LINKBLOCKS    7  // ... link writes
+#define UNLINKBLOCKS  4  // ... unlink writes
+#define IPUTBLOCKS    2  // ... an op that only releases inodes writes
+#define LOGSIZE     124  // max data blocks in on-disk log
+#define NBUF         (LOGSIZE*2+MAXOPBLOCKS*3)  // initial and minimum size of disk block cache
+#define NBUFMAX      8192  // maximum size of disk block cache
+#define FSSIZE       4000  // size of file system in blocks
+#define NINODES      2000  // inodes in the file system
 
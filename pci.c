@@ -0,0 +1,97 @@
+// PCI bus enumeration through configuration mechanism #1.
+// pciinit() records every function on bus 0, which is where
+// QEMU puts its devices; drivers look theirs up with pcifind().
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define CONFADDR  0xcf8
+#define CONFDATA  0xcfc
+
+static struct pcidev pcidevs[PCI_MAXDEV];
+static int npcidev;
+
+uint
+pciread(struct pcidev *d, int off)
+{
+  outl(CONFADDR, 0x80000000 | d->bus<<16 | d->dev<<11 | d->func<<8 | (off & 0xfc));
+  return inl(CONFDATA);
+}
+
+void
+pciwrite(struct pcidev *d, int off, uint v)
+{
+  outl(CONFADDR, 0x80000000 | d->bus<<16 | d->dev<<11 | d->func<<8 | (off & 0xfc));
+  outl(CONFDATA, v);
+}
+
+// Record function f of device dev on bus 0, if present.
+// Return its header type, or -1 if there is none.
+static int
+pciprobe(int dev, int f)
+{
+  struct pcidev *d;
+  uint id, class, hdr, bar;
+  int i;
+
+  if(npcidev == PCI_MAXDEV)
+    return -1;
+  d = &pcidevs[npcidev];
+  memset(d, 0, sizeof(*d));
+  d->dev = dev;
+  d->func = f;
+  id = pciread(d, PCI_ID);
+  if((id & 0xffff) == 0xffff)
+    return -1;
+  d->vendor = id & 0xffff;
+  d->device = id >> 16;
+  class = pciread(d, PCI_CLASS);
+  d->class = class >> 24;
+  d->subclass = class >> 16;
+  d->progif = class >> 8;
+  hdr = pciread(d, PCI_HDR) >> 16;
+  if((hdr & 0x7f) == 0){
+    for(i = 0; i < 6; i++){
+      bar = pciread(d, PCI_BAR0 + 4*i);
+      if(bar & 1){
+        d->iobar |= 1 << i;
+        d->bar[i] = bar & ~3;
+      } else
+        d->bar[i] = bar & ~0xf;
+    }
+    d->irq = pciread(d, PCI_INTR) & 0xff;
+  }
+  npcidev++;
+  return hdr;
+}
+
+void
+pciinit(void)
+{
+  int dev, f, hdr;
+
+  for(dev = 0; dev < 32; dev++){
+    hdr = pciprobe(dev, 0);
+    if(hdr >= 0 && (hdr & 0x80))  // multi-function device
+      for(f = 1; f < 8; f++)
+        pciprobe(dev, f);
+  }
+}
+
+// Find the first device of the given class and subclass,
+// or with the given vendor and device ids if class is -1.
+struct pcidev*
+pcifind(int class, int subclass, int vendor, int device)
+{
+  struct pcidev *d;
+
+  for(d = pcidevs; d < pcidevs+npcidev; d++){
+    if(class >= 0 && d->class == class && d->subclass == subclass)
+      return d;
+    if(class < 0 && d->vendor == vendor && d->device == device)
+      return d;
+  }
+  return 0;
+}
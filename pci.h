@@ -0,0 +1,32 @@
+// PCI configuration space.
+
+#define PCI_MAXDEV     32  // devices remembered by pciinit
+
+// Configuration space registers.
+#define PCI_ID         0x00  // vendor, device
+#define PCI_CMD        0x04  // command, status
+#define PCI_CLASS      0x08  // revision, prog if, subclass, class
+#define PCI_HDR        0x0c  // ..., header type, ...
+#define PCI_BAR0       0x10  // base address registers 0-5
+#define PCI_INTR       0x3c  // interrupt line, pin, ...
+
+// Command register bits.
+#define PCI_CMD_IO     0x1   // respond to I/O space accesses
+#define PCI_CMD_MEM    0x2   // respond to memory space accesses
+#define PCI_CMD_MASTER 0x4   // may act as bus master (DMA)
+
+// Device class codes.
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE  0x01
+
+struct pcidev {
+  uint bus, dev, func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar progif;
+  uchar irq;        // interrupt line
+  uint bar[6];      // base addresses; I/O BARs have the low bits cleared
+  uint iobar;       // bit i set if bar[i] is in I/O space
+};
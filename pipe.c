@@ -7,6 +7,7 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "uio.h"
 
 #define PIPESIZE 512
 
@@ -75,22 +76,30 @@ pipeclose(struct pipe *p, int writable)
 }
 
 //PAGEBREAK: 40
+// Write the cnt buffers in iov to the pipe, waking readers
+// once at the end rather than once per buffer.
 int
-pipewrite(struct pipe *p, char *addr, int n)
+pipewritev(struct pipe *p, struct iovec *iov, int cnt)
 {
-  int i;
+  int i, j, n;
+  char *addr;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(p->readopen == 0 || myproc()->killed){
-        release(&p->lock);
-        return -1;
+  n = 0;
+  for(j = 0; j < cnt; j++){
+    addr = iov[j].base;
+    for(i = 0; i < iov[j].len; i++){
+      while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+        if(p->readopen == 0 || myproc()->killed){
+          release(&p->lock);
+          return -1;
+        }
+        wakeup(&p->nread);
+        sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
       }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      p->data[p->nwrite++ % PIPESIZE] = addr[i];
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    n += iov[j].len;
   }
   wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
@@ -98,9 +107,22 @@ pipewrite(struct pipe *p, char *addr, int n)
 }
 
 int
-piperead(struct pipe *p, char *addr, int n)
+pipewrite(struct pipe *p, char *addr, int n)
+{
+  struct iovec iov;
+
+  iov.base = addr;
+  iov.len = n;
+  return pipewritev(p, &iov, 1);
+}
+
+// Read what the pipe holds, up to the total size of the cnt
+// buffers in iov, filling them in order.
+int
+pipereadv(struct pipe *p, struct iovec *iov, int cnt)
 {
-  int i;
+  int i, j, n;
+  char *addr;
 
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
@@ -110,12 +132,27 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  n = 0;
+  for(j = 0; j < cnt && p->nread != p->nwrite; j++){
+    addr = iov[j].base;
+    for(i = 0; i < iov[j].len; i++){  //DOC: piperead-copy
+      if(p->nread == p->nwrite)
+        break;
+      addr[i] = p->data[p->nread++ % PIPESIZE];
+    }
+    n += i;
   }
   wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
-  return i;
+  return n;
+}
+
+int
+piperead(struct pipe *p, char *addr, int n)
+{
+  struct iovec iov;
+
+  iov.base = addr;
+  iov.len = n;
+  return pipereadv(p, &iov, 1);
 }
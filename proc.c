@@ -91,6 +91,9 @@ found:
 
   release(&ptable.lock);
 
+  fdinit(p);
+  memset(p->vma, 0, sizeof(p->vma));
+
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
     p->state = UNUSED;
@@ -163,6 +166,8 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
+    if(sz + n < sz || sz + n > mmapbase(curproc))
+      return -1;
     if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   } else if(n < 0){
@@ -180,7 +185,7 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int pid;
   struct proc *np;
   struct proc *curproc = myproc();
 
@@ -203,9 +208,21 @@ fork(void)
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
-  for(i = 0; i < NOFILE; i++)
-    if(curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
+  if(fdcopy(np, curproc) < 0){
+    freevm(np->pgdir);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  if(mmapfork(np, curproc) < 0){
+    fdcloseall(np);
+    freevm(np->pgdir);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
   np->cwd = idup(curproc->cwd);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
@@ -221,6 +238,56 @@ fork(void)
   return pid;
 }
 
+// A new kernel thread's first scheduling by scheduler()
+// will swtch here.  Run fn, which must never return.
+static void
+kthreadstart(void (*fn)(void))
+{
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+  fn();
+  panic("kthread return");
+}
+
+// Create a kernel thread that runs fn(), such as the log
+// flusher.  It has no user memory and never leaves the kernel.
+int
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *np;
+  char *sp;
+
+  if((np = allocproc()) == 0)
+    return -1;
+  if((np->pgdir = setupkvm()) == 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  np->sz = 0;
+  np->tf = 0;
+
+  // Start at kthreadstart(fn) instead of forkret.
+  sp = np->kstack + KSTACKSIZE;
+  sp -= 4;
+  *(uint*)sp = (uint)fn;
+  sp -= 4;
+  *(uint*)sp = 0;  // fake return PC
+  sp -= sizeof *np->context;
+  np->context = (struct context*)sp;
+  memset(np->context, 0, sizeof *np->context);
+  np->context->eip = (uint)kthreadstart;
+
+  safestrcpy(np->name, name, sizeof(np->name));
+
+  acquire(&ptable.lock);
+  np->state = RUNNABLE;
+  release(&ptable.lock);
+
+  return np->pid;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -229,20 +296,15 @@ exit(void)
 {
   struct proc *curproc = myproc();
   struct proc *p;
-  int fd;
 
   if(curproc == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd]){
-      fileclose(curproc->ofile[fd]);
-      curproc->ofile[fd] = 0;
-    }
-  }
+  // Unmap memory, writing back shared pages, and close all open files.
+  mmapexit(curproc);
+  fdcloseall(curproc);
 
-  begin_op();
+  begin_op(IPUTBLOCKS);
   iput(curproc->cwd);
   end_op();
   curproc->cwd = 0;
@@ -407,6 +469,7 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    filelimits();
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -32,6 +32,16 @@ struct context {
   uint eip;
 };
 
+// A memory mapping (see mmap.c).
+struct vma {
+  uint addr;           // first address, page-aligned
+  uint len;            // bytes mapped, a multiple of PGSIZE; 0 if unused
+  int prot;            // PROT_READ, PROT_WRITE
+  int flags;           // MAP_SHARED or MAP_PRIVATE, MAP_ANON
+  struct file *f;      // mapped file, or 0 for anonymous memory
+  uint off;            // offset in f of addr
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -46,8 +56,13 @@ struct proc {
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
+  struct file **ofile;         // Open files: ofile0 or a page
+  int nofile;                  // Entries in ofile
+  uint fdused[NOFILEMAX/32];   // Descriptors in use
+  uint fdfull;                 // Bit i set if fdused[i] is all ones
+  struct file *ofile0[NOFILE]; // Initial descriptor table
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // Memory mappings
   char name[16];               // Process name (debugging)
 };
 
@@ -56,3 +71,5 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+//   ...
+//   memory mappings, allocated downward from KERNBASE
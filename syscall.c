@@ -54,21 +54,40 @@ argint(int n, int *ip)
 
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+// lies within the process address space and, if it is in a
+// memory mapping, that the mapping lets the kernel write it
+// if write is set.
+static int
+argbuf(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0)
+    return -1;
+  if(((uint)i >= curproc->sz || (uint)i+size > curproc->sz) &&
+     mmapcheck(i, size, write) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Fetch a pointer argument to memory that the kernel may write.
+int
+argptr(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 1);
+}
+
+// Fetch a pointer argument to memory that the kernel only reads.
+int
+argptr_ro(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 0);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -103,6 +122,18 @@ extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
 extern int sys_uptime(void);
+extern int sys_iostat(void);
+extern int sys_fsync(void);
+extern int sys_sync(void);
+extern int sys_crashafter(void);
+extern int sys_getdents(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_lseek(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -126,6 +157,18 @@ static int (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_iostat]  sys_iostat,
+[SYS_fsync]   sys_fsync,
+[SYS_sync]    sys_sync,
+[SYS_crashafter] sys_crashafter,
+[SYS_getdents] sys_getdents,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_lseek]   sys_lseek,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
 };
 
 void
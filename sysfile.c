@@ -15,6 +15,8 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "iostat.h"
+#include "uio.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -26,7 +28,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= myproc()->nofile || (f=myproc()->ofile[fd]) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -35,21 +37,39 @@ argfd(int n, int *pfd, struct file **pf)
   return 0;
 }
 
-// Allocate a file descriptor for the given file.
-// Takes over file reference from caller on success.
+// Fetch the nth and n+1th system call arguments as an array of
+// iovecs and their count, and copy the array to iov, a page.
+// Check that every buffer in the copy is valid, and writable by
+// the kernel if write is set, and that their total size fits in
+// an int.  The file layer sees only the
+// copy, which user code can't change under it.
 static int
-fdalloc(struct file *f)
+argiov(int n, struct iovec *iov, int *pcnt, int write)
 {
-  int fd;
   struct proc *curproc = myproc();
+  char *uiov;
+  int cnt, i;
+  uint b, total;
 
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd] == 0){
-      curproc->ofile[fd] = f;
-      return fd;
-    }
+  if(argint(n+1, &cnt) < 0 || cnt < 0 || cnt > IOVMAX)
+    return -1;
+  if(argptr_ro(n, &uiov, cnt*sizeof(struct iovec)) < 0)
+    return -1;
+  memmove(iov, uiov, cnt*sizeof(struct iovec));
+  total = 0;
+  for(i = 0; i < cnt; i++){
+    b = (uint)iov[i].base;
+    if(iov[i].len < 0)
+      return -1;
+    if((b >= curproc->sz || b+iov[i].len > curproc->sz) &&
+       mmapcheck(b, iov[i].len, write) < 0)
+      return -1;
+    total += iov[i].len;
+    if(total > 0x7fffffff)
+      return -1;
   }
-  return -1;
+  *pcnt = cnt;
+  return 0;
 }
 
 int
@@ -85,11 +105,118 @@ sys_write(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr_ro(1, &p, n) < 0)
     return -1;
   return filewrite(f, p, n);
 }
 
+int
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr_ro(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+int
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &whence) < 0)
+    return -1;
+  return fileseek(f, off, whence);
+}
+
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec *iov;
+  int cnt, r;
+
+  if(argfd(0, 0, &f) < 0 || (iov = (struct iovec*)kalloc()) == 0)
+    return -1;
+  r = -1;
+  if(argiov(1, iov, &cnt, 1) == 0)
+    r = filereadv(f, iov, cnt);
+  kfree((char*)iov);
+  return r;
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec *iov;
+  int cnt, r;
+
+  if(argfd(0, 0, &f) < 0 || (iov = (struct iovec*)kalloc()) == 0)
+    return -1;
+  r = -1;
+  if(argiov(1, iov, &cnt, 0) == 0)
+    r = filewritev(f, iov, cnt);
+  kfree((char*)iov);
+  return r;
+}
+
+// Map len bytes of file fd at offset off, or anonymous memory
+// if flags has MAP_ANON.  The address argument is only a hint,
+// and is ignored.  Anonymous memory can't be MAP_SHARED: fork
+// gives the child a copy of it.
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int len, prot, flags, off, share;
+
+  if(argint(1, &len) < 0 || argint(2, &prot) < 0 || argint(3, &flags) < 0 ||
+     argint(5, &off) < 0 || len <= 0 || off < 0)
+    return -1;
+  share = flags & (MAP_SHARED|MAP_PRIVATE);
+  if(share != MAP_SHARED && share != MAP_PRIVATE)
+    return -1;
+  if(flags & MAP_ANON){
+    if(share == MAP_SHARED)
+      return -1;
+    return mmap(len, prot, flags, 0, 0);
+  }
+  if(argfd(4, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+    return -1;
+  if(share == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+    return -1;
+  return munmap(addr, len);
+}
+
 int
 sys_close(void)
 {
@@ -98,7 +225,7 @@ sys_close(void)
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  fdfree(myproc(), fd);
   fileclose(f);
   return 0;
 }
@@ -114,6 +241,28 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Make the file's completed writes durable.  Committed
+// transactions survive a crash, so waiting for the log
+// to commit is enough.
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0 || f->type != FD_INODE)
+    return -1;
+  log_force();
+  return 0;
+}
+
+// Write every committed block to its home location.
+int
+sys_sync(void)
+{
+  log_sync();
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
@@ -124,7 +273,7 @@ sys_link(void)
   if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
     return -1;
 
-  begin_op();
+  begin_op(LINKBLOCKS);
   if((ip = namei(old)) == 0){
     end_op();
     return -1;
@@ -192,7 +341,7 @@ sys_unlink(void)
   if(argstr(0, &path) < 0)
     return -1;
 
-  begin_op();
+  begin_op(UNLINKBLOCKS);
   if((dp = nameiparent(path, name)) == 0){
     end_op();
     return -1;
@@ -218,6 +367,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcenter(dp, name, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -257,7 +407,7 @@ create(char *path, short type, short major, short minor)
     return 0;
   }
 
-  if((ip = ialloc(dp->dev, type)) == 0)
+  if((ip = ialloc(dp->dev, type, dp->inum)) == 0)
     panic("create: ialloc");
 
   ilock(ip);
@@ -293,7 +443,7 @@ sys_open(void)
   if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
     return -1;
 
-  begin_op();
+  begin_op(omode & O_CREATE ? MAXOPBLOCKS : IPUTBLOCKS);
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -338,7 +488,7 @@ sys_mkdir(void)
   char *path;
   struct inode *ip;
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
@@ -355,7 +505,7 @@ sys_mknod(void)
   char *path;
   int major, minor;
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   if((argstr(0, &path)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
@@ -375,7 +525,7 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *curproc = myproc();
   
-  begin_op();
+  begin_op(IPUTBLOCKS);
   if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
@@ -433,7 +583,7 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
+      fdfree(myproc(), fd0);
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -442,3 +592,49 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_iostat(void)
+{
+  struct iostat *st;
+
+  if(argptr(0, (void*)&st, sizeof(*st)) < 0)
+    return -1;
+  memset(st, 0, sizeof(*st));
+  bstat(st);
+  idestat(st);
+  virtiostat(st);
+  logstat(st);
+  fsstat(st);
+  return 0;
+}
+
+// Read up to n entries of a directory, with their
+// attributes if flags has GD_STAT.  Returns the number
+// read, 0 at the end of the directory.
+int
+sys_getdents(void)
+{
+  struct file *f;
+  struct gdent *ents;
+  int n, flags;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || n < 0 ||
+     n > 0x7fffffff / sizeof(*ents) ||
+     argptr(1, (void*)&ents, n*sizeof(*ents)) < 0 || argint(3, &flags) < 0)
+    return -1;
+  return filegetdents(f, ents, n, flags);
+}
+
+// Crash the system after n more disk writes, to test
+// log recovery.
+int
+sys_crashafter(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0 || n < 0)
+    return -1;
+  bcrash(n);
+  return 0;
+}
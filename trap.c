@@ -80,6 +80,13 @@ trap(struct trapframe *tf)
 
   //PAGEBREAK: 13
   default:
+    if(tf->trapno >= T_IRQ0 && virtiointr(tf->trapno - T_IRQ0)){
+      lapiceoi();
+      break;
+    }
+    if(tf->trapno == T_PGFLT && myproc() && (tf->cs&3) == DPL_USER &&
+       mmapfault(rcr2(), tf->err & FEC_WR) == 0)
+      break;
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
@@ -0,0 +1,7 @@
+// Vectored I/O, for the readv and writev system calls.
+struct iovec {
+  void *base;   // start of the buffer
+  int len;      // bytes in it
+};
+
+#define IOVMAX  512   // most buffers in one call; a page of iovecs
@@ -1,5 +1,8 @@
 struct stat;
 struct rtcdate;
+struct iostat;
+struct gdent;
+struct iovec;
 
 // system calls
 int fork(void);
@@ -23,6 +26,18 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int iostat(struct iostat*);
+int fsync(int);
+int sync(void);
+int crashafter(int);
+int getdents(int, struct gdent*, int, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int lseek(int, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -4,6 +4,7 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "uio.h"
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
@@ -184,6 +185,11 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// Blocks in writetest1's file: through the single-indirect block
+// and eight blocks of the double-indirect block, rather than all
+// of MAXFILE, which would not fit on the disk.
+#define BIGBLOCKS (NDIRECT + 9*NINDIRECT)
+
 void
 writetest1(void)
 {
@@ -197,7 +203,7 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, 512) != 512){
       printf(stdout, "error: write big file failed\n", i);
@@ -217,7 +223,7 @@ writetest1(void)
   for(;;){
     i = read(fd, buf, 512);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGBLOCKS){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
@@ -916,6 +922,18 @@ bigdir(void)
     }
   }
 
+  for(i = 0; i < 500; i++){
+    name[0] = 'x';
+    name[1] = '0' + (i / 64);
+    name[2] = '0' + (i % 64);
+    name[3] = '\0';
+    if((fd = open(name, 0)) < 0){
+      printf(1, "bigdir open %s failed\n", name);
+      exit();
+    }
+    close(fd);
+  }
+
   unlink("bd");
   for(i = 0; i < 500; i++){
     name[0] = 'x';
@@ -1373,6 +1391,614 @@ iref(void)
   printf(1, "empty file name OK\n");
 }
 
+// test that more inodes than NINODE can be in use at once
+void
+manyinodes(void)
+{
+  enum { NCHILD = 7, NOPEN = 12 };
+  char name[] = "mi00";
+  int i, j, n, fd, pid, p[2], q[2];
+  char c;
+
+  printf(1, "many inodes test\n");
+
+  if(pipe(p) < 0 || pipe(q) < 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      close(q[1]);
+      name[2] = '0' + i;
+      for(j = 0; j < NOPEN; j++){
+        name[3] = 'a' + j;
+        if(open(name, O_CREATE|O_RDWR) < 0){
+          printf(1, "create %s failed\n", name);
+          exit();
+        }
+      }
+      write(p[1], "x", 1);
+      read(q[0], &c, 1);  // hold the files open until the parent is done
+      exit();
+    }
+  }
+  close(q[0]);
+  close(p[1]);
+  for(n = 0; n < NCHILD && read(p[0], &c, 1) == 1; n++)
+    ;
+  close(p[0]);
+  close(q[1]);
+  for(i = 0; i < NCHILD; i++)
+    wait();
+  if(n != NCHILD){
+    printf(1, "many inodes: only %d children opened their files\n", n);
+    exit();
+  }
+
+  for(i = 0; i < NCHILD; i++){
+    name[2] = '0' + i;
+    for(j = 0; j < NOPEN; j++){
+      name[3] = 'a' + j;
+      if((fd = open(name, 0)) < 0){
+        printf(1, "open %s failed\n", name);
+        exit();
+      }
+      close(fd);
+      unlink(name);
+    }
+  }
+
+  printf(1, "many inodes ok\n");
+}
+
+int
+exists(char *path)
+{
+  int fd;
+
+  if((fd = open(path, 0)) < 0)
+    return 0;
+  close(fd);
+  return 1;
+}
+
+// Set path to "hd/h<i>" and return whether the name's hash,
+// FNV-1a as in fs.c, has its low three bits clear.
+int
+hdname(int i, char *path)
+{
+  char d[10];
+  char *p;
+  uint h;
+  int n;
+
+  n = 0;
+  do {
+    d[n++] = '0' + i % 10;
+    i /= 10;
+  } while(i > 0);
+  strcpy(path, "hd/h");
+  p = path + 4;
+  while(n > 0)
+    *p++ = d[--n];
+  *p = 0;
+
+  h = 2166136261;
+  for(p = path + 3; *p; p++)
+    h = (h ^ (uchar)*p) * 16777619;
+  return (h & 7) == 0;
+}
+
+// a hashed directory whose names all fall in one bucket, which
+// must be split several times over, including after the table
+// has grown past the bits the names share.
+void
+hashdirtest(void)
+{
+  char path[16];
+  int fd, i, n;
+
+  printf(1, "hashdir test\n");
+
+  if(mkdir("hd") != 0 || (fd = open("hd/f", O_CREATE)) < 0){
+    printf(1, "hashdir: create failed\n");
+    exit();
+  }
+  close(fd);
+
+  for(i = n = 0; n < 3*DPB; i++){
+    if(!hdname(i, path))
+      continue;
+    n++;
+    if(link("hd/f", path) != 0){
+      printf(1, "hashdir: link %s failed\n", path);
+      exit();
+    }
+  }
+  for(i = n = 0; n < 3*DPB; i++){
+    if(!hdname(i, path))
+      continue;
+    n++;
+    if((fd = open(path, 0)) < 0){
+      printf(1, "hashdir: open %s failed\n", path);
+      exit();
+    }
+    close(fd);
+  }
+  for(i = n = 0; n < 3*DPB; i++){
+    if(!hdname(i, path))
+      continue;
+    n++;
+    if(unlink(path) != 0){
+      printf(1, "hashdir: unlink %s failed\n", path);
+      exit();
+    }
+  }
+  if(unlink("hd/f") != 0 || unlink("hd") != 0){
+    printf(1, "hashdir: unlink hd failed\n");
+    exit();
+  }
+  printf(1, "hashdir ok\n");
+}
+
+// test that path lookups see names created and removed
+// since they were last looked up
+void
+dcachetest(void)
+{
+  int fd;
+
+  printf(1, "dcache test\n");
+
+  if(exists("dcf")){
+    printf(1, "dcache: dcf exists\n");
+    exit();
+  }
+  fd = open("dcf", O_CREATE|O_RDWR);
+  if(fd < 0 || !exists("dcf")){
+    printf(1, "dcache: create dcf failed\n");
+    exit();
+  }
+  close(fd);
+  if(link("dcf", "dcg") != 0 || !exists("dcg")){
+    printf(1, "dcache: link dcg failed\n");
+    exit();
+  }
+  unlink("dcf");
+  unlink("dcg");
+  if(exists("dcf") || exists("dcg")){
+    printf(1, "dcache: unlinked names still found\n");
+    exit();
+  }
+
+  // a directory's inode may be reused by one with another parent
+  if(mkdir("dca") != 0 || mkdir("dca/dcb") != 0 || chdir("dca/dcb") != 0 ||
+     !exists("../dcb")){
+    printf(1, "dcache: mkdir dca/dcb failed\n");
+    exit();
+  }
+  chdir("/");
+  unlink("dca/dcb");
+  if(mkdir("dcb") != 0 || mkdir("dcb/dcc") != 0 || !exists("dcb/dcc/../../dca")){
+    printf(1, "dcache: .. of new directory wrong\n");
+    exit();
+  }
+  unlink("dcb/dcc");
+  unlink("dcb");
+  unlink("dca");
+
+  printf(1, "dcache ok\n");
+}
+
+// test that getdents returns every entry of a directory,
+// a few at a time, with the right attributes
+void
+getdentstest(void)
+{
+  enum { N = 40 };
+  struct gdent ents[7];
+  char name[] = "gd/f00";
+  int i, j, k, n, fd, seen[N];
+
+  printf(1, "getdents test\n");
+
+  if(mkdir("gd") != 0){
+    printf(1, "getdents: mkdir failed\n");
+    exit();
+  }
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i/10;
+    name[5] = '0' + i%10;
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0){
+      printf(1, "getdents: create %s failed\n", name);
+      exit();
+    }
+    write(fd, buf, i);
+    close(fd);
+    seen[i] = 0;
+  }
+
+  if((fd = open("gd", 0)) < 0){
+    printf(1, "getdents: open gd failed\n");
+    exit();
+  }
+  k = 0;
+  while((n = getdents(fd, ents, 7, GD_STAT)) > 0){
+    for(j = 0; j < n; j++, k++){
+      if(strcmp(ents[j].name, ".") == 0 || strcmp(ents[j].name, "..") == 0){
+        if(ents[j].type != T_DIR){
+          printf(1, "getdents: %s not a directory\n", ents[j].name);
+          exit();
+        }
+        continue;
+      }
+      i = (ents[j].name[1] - '0')*10 + ents[j].name[2] - '0';
+      if(ents[j].name[0] != 'f' || i < 0 || i >= N || seen[i]++ ||
+         ents[j].type != T_FILE || ents[j].size != i || ents[j].nlink != 1){
+        printf(1, "getdents: bad entry %s\n", ents[j].name);
+        exit();
+      }
+    }
+  }
+  close(fd);
+  if(n < 0 || k != N + 2){
+    printf(1, "getdents: got %d entries\n", k);
+    exit();
+  }
+  if((fd = open("gd/f00", 0)) < 0 || getdents(fd, ents, 7, 0) >= 0){
+    printf(1, "getdents: read a file\n");
+    exit();
+  }
+  close(fd);
+
+  for(i = 0; i < N; i++){
+    name[4] = '0' + i/10;
+    name[5] = '0' + i%10;
+    unlink(name);
+  }
+  unlink("gd");
+  printf(1, "getdents ok\n");
+}
+
+// test that a small file kept in its inode reads back, and
+// still does after growing out of it
+void
+inlinetest(void)
+{
+  int fd, i, n;
+
+  printf(1, "inline test\n");
+
+  for(i = 0; i < 300; i++)
+    buf[i] = 'a' + i % 23;
+  fd = open("inl", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, 50) != 50 || write(fd, buf+50, 50) != 50){
+    printf(1, "inline: write failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("inl", O_RDWR);
+  n = read(fd, buf+1000, sizeof(buf)-1000);
+  for(i = 0; i < n && buf[1000+i] == buf[i]; i++)
+    ;
+  if(n != 100 || i != n){
+    printf(1, "inline: read %d bytes back wrong\n", n);
+    exit();
+  }
+  if(write(fd, buf+100, 200) != 200){
+    printf(1, "inline: growing write failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("inl", 0);
+  n = read(fd, buf+1000, sizeof(buf)-1000);
+  for(i = 0; i < n && buf[1000+i] == buf[i]; i++)
+    ;
+  if(n != 300 || i != n){
+    printf(1, "inline: read %d bytes back wrong after growing\n", n);
+    exit();
+  }
+  close(fd);
+  unlink("inl");
+  printf(1, "inline ok\n");
+}
+
+// pread and pwrite use their own offsets; lseek moves the file's.
+void
+preadtest(void)
+{
+  int fd;
+
+  printf(1, "pread test\n");
+
+  fd = open("prw", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "0123456789", 10) != 10){
+    printf(1, "pread: create failed\n");
+    exit();
+  }
+  if(pwrite(fd, "ab", 2, 3) != 2 || pread(fd, buf, 4, 2) != 4 ||
+     buf[0] != '2' || buf[1] != 'a' || buf[2] != 'b' || buf[3] != '5'){
+    printf(1, "pread: pwrite/pread wrong\n");
+    exit();
+  }
+  if(lseek(fd, 0, SEEK_CUR) != 10 || write(fd, "x", 1) != 1){
+    printf(1, "pread: offset moved\n");
+    exit();
+  }
+  if(lseek(fd, -3, SEEK_END) != 8 || read(fd, buf, 10) != 3 || buf[0] != '8'){
+    printf(1, "pread: lseek SEEK_END wrong\n");
+    exit();
+  }
+  if(lseek(fd, -1, SEEK_SET) >= 0 || pread(fd, buf, 1, 11) != 0){
+    printf(1, "pread: bad offset accepted\n");
+    exit();
+  }
+  close(fd);
+  unlink("prw");
+  printf(1, "pread ok\n");
+}
+
+// writev and readv on a file and a pipe.
+void
+iovtest(void)
+{
+  struct iovec iov[3];
+  int fd, fds[2], i;
+
+  printf(1, "iov test\n");
+
+  iov[0].base = "hello ";
+  iov[0].len = 6;
+  iov[1].base = "";
+  iov[1].len = 0;
+  iov[2].base = "world";
+  iov[2].len = 5;
+  fd = open("iov", O_CREATE|O_RDWR);
+  if(fd < 0 || writev(fd, iov, 3) != 11){
+    printf(1, "iov: writev failed\n");
+    exit();
+  }
+  close(fd);
+
+  iov[0].base = buf;
+  iov[0].len = 3;
+  iov[1].base = buf+100;
+  iov[1].len = 100;
+  fd = open("iov", 0);
+  if(readv(fd, iov, 2) != 11 || buf[0] != 'h' || buf[2] != 'l' ||
+     buf[100] != 'l' || buf[107] != 'r'){
+    printf(1, "iov: readv wrong\n");
+    exit();
+  }
+  close(fd);
+  unlink("iov");
+
+  if(pipe(fds) != 0){
+    printf(1, "iov: pipe failed\n");
+    exit();
+  }
+  for(i = 0; i < 3; i++){
+    iov[i].base = buf + 1000*i;
+    iov[i].len = 150;
+  }
+  if(writev(fds[1], iov, 3) != 450 || readv(fds[0], iov, 3) != 450){
+    printf(1, "iov: pipe writev/readv wrong\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  iov[0].base = (void*)0x7fffffff;
+  iov[0].len = 1;
+  fd = open("iov", O_CREATE|O_RDWR);
+  if(writev(fd, iov, 1) >= 0){
+    printf(1, "iov: writev of bad buffer succeeded\n");
+    exit();
+  }
+
+  // A readv that overwrites its own iovec array must still
+  // use the buffers it was given.
+  iov[0].base = (void*)KERNBASE;
+  iov[0].len = 10;
+  if(write(fd, iov, sizeof(iov[0])) != sizeof(iov[0]) ||
+     write(fd, "0123456789", 10) != 10){
+    printf(1, "iov: write failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("iov", 0);
+  iov[0].base = &iov[1];
+  iov[0].len = sizeof(iov[1]);
+  iov[1].base = buf;
+  iov[1].len = 10;
+  if(readv(fd, iov, 2) != sizeof(iov[1]) + 10 || buf[0] != '0' ||
+     iov[1].base != (void*)KERNBASE){
+    printf(1, "iov: readv into its own iovecs wrong\n");
+    exit();
+  }
+  close(fd);
+  unlink("iov");
+  printf(1, "iov ok\n");
+}
+
+// map a file privately and shared, and anonymous memory.
+void
+mmaptest(void)
+{
+  enum { PG = 4096, SZ = 2*PG + 2048 };
+  char *p;
+  int fd, i, pid;
+
+  printf(1, "mmap test\n");
+
+  for(i = 0; i < PG; i++)
+    buf[i] = 'a' + i % 26;
+  fd = open("mm", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, PG) != PG || write(fd, buf, PG) != PG ||
+     write(fd, buf, 2048) != 2048){
+    printf(1, "mmap: create failed\n");
+    exit();
+  }
+
+  p = mmap(0, SZ, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf(1, "mmap: private mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < 3*PG; i++){
+    if(p[i] != (i < SZ ? 'a' + i % PG % 26 : 0)){
+      printf(1, "mmap: byte %d wrong\n", i);
+      exit();
+    }
+  }
+  // The kernel can use mapped memory as a buffer.
+  if(pwrite(fd, p + PG, 10, SZ) != 10 || pread(fd, buf, 10, SZ) != 10 ||
+     buf[0] != 'a' || buf[9] != 'j'){
+    printf(1, "mmap: write from mapped memory failed\n");
+    exit();
+  }
+  if(pread(fd, p, 10, 0) >= 0){
+    printf(1, "mmap: read into read-only mapping succeeded\n");
+    exit();
+  }
+  if(munmap(p, SZ) < 0){
+    printf(1, "mmap: munmap failed\n");
+    exit();
+  }
+
+  p = mmap(0, 2*PG, PROT_READ|PROT_WRITE, MAP_SHARED, fd, PG);
+  if(p == (char*)-1){
+    printf(1, "mmap: shared mmap failed\n");
+    exit();
+  }
+  p[0] = 'Z';
+  p[PG+5] = 'Y';
+  // Parent and child share the pages, and read() and write()
+  // see the same bytes as the mapping.
+  pid = fork();
+  if(pid == 0){
+    if(p[0] != 'Z' || p[PG+5] != 'Y')
+      printf(1, "mmap: child's view wrong\n");
+    p[1] = 'X';
+    exit();
+  }
+  wait();
+  if(p[1] != 'X'){
+    printf(1, "mmap: child's store not shared\n");
+    exit();
+  }
+  if(pread(fd, buf, 2, PG) != 2 || buf[0] != 'Z' || buf[1] != 'X'){
+    printf(1, "mmap: read doesn't see the mapping\n");
+    exit();
+  }
+  if(pwrite(fd, "W", 1, 2*PG+6) != 1 || p[PG+6] != 'W'){
+    printf(1, "mmap: mapping doesn't see write\n");
+    exit();
+  }
+  munmap(p, 2*PG);
+  if(pread(fd, buf, 2, PG) != 2 || buf[0] != 'Z' || buf[1] != 'X' ||
+     pread(fd, buf, 2, 2*PG+5) != 2 || buf[0] != 'Y' || buf[1] != 'W'){
+    printf(1, "mmap: shared writes not written back\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("mm", O_RDONLY);
+  if(mmap(0, PG, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1){
+    printf(1, "mmap: writable mapping of read-only file\n");
+    exit();
+  }
+  close(fd);
+  unlink("mm");
+
+  if(mmap(0, PG, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0) != (char*)-1){
+    printf(1, "mmap: shared anonymous mapping\n");
+    exit();
+  }
+  p = mmap(0, 3*PG, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  if(p == (char*)-1 || p[0] != 0 || p[3*PG-1] != 0){
+    printf(1, "mmap: anonymous mmap failed\n");
+    exit();
+  }
+  p[PG] = 1;
+  if(munmap(p + 2*PG, PG) < 0 || munmap(p, 2*PG) < 0){
+    printf(1, "mmap: anonymous munmap failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    if(p[PG] == 1)
+      printf(1, "mmap: read unmapped memory\n");
+    exit();
+  }
+  wait();
+  printf(1, "mmap ok\n");
+}
+
+// several processes with hundreds of open files each;
+// descriptors must be allocated lowest first.
+void
+manyfds(void)
+{
+  int fd, i, j, n, pid;
+
+  printf(1, "many fds test\n");
+
+  fd = open("fds", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "x", 1) != 1){
+    printf(1, "manyfds: create failed\n");
+    exit();
+  }
+  close(fd);
+
+  for(i = 0; i < 4; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      for(n = 3; (fd = open("fds", 0)) >= 0; n++){
+        if(fd != n){
+          printf(1, "manyfds: open returned %d, not %d\n", fd, n);
+          exit();
+        }
+      }
+      if(n < 1000){
+        printf(1, "manyfds: only %d fds\n", n);
+        exit();
+      }
+      for(j = 100; j < 900; j += 100)
+        close(j);
+      for(j = 100; j < 900; j += 100){
+        if((fd = open("fds", 0)) != j){
+          printf(1, "manyfds: reopen returned %d, not %d\n", fd, j);
+          exit();
+        }
+      }
+      pid = fork();
+      if(pid == 0){
+        if(read(n-1, buf, 1) != 1 || buf[0] != 'x'){
+          printf(1, "manyfds: inherited fd failed\n");
+          exit();
+        }
+        exit();
+      }
+      wait();
+      exit();
+    }
+  }
+  for(i = 0; i < 4; i++)
+    wait();
+  unlink("fds");
+  printf(1, "many fds ok\n");
+}
+
 // test that fork fails gracefully
 // the forktest binary also does this, but it runs out of proc entries first.
 // inside the bigger usertests binary, we run out of memory first.
@@ -1695,6 +2321,59 @@ fsfull()
   printf(1, "fsfull test finished\n");
 }
 
+// fsync() and sync() must succeed on files, and the
+// data must read back after it has been written home.
+void
+synctest(void)
+{
+  int fd, i, p[2];
+
+  printf(1, "sync test\n");
+  unlink("syncfile");
+  fd = open("syncfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "create syncfile failed\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++){
+    memset(buf, 'a'+i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf(1, "write syncfile failed\n");
+      exit();
+    }
+    if(fsync(fd) != 0){
+      printf(1, "fsync syncfile failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  if(pipe(p) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  if(fsync(p[0]) == 0){
+    printf(1, "fsync pipe succeeded!\n");
+    exit();
+  }
+  close(p[0]);
+  close(p[1]);
+  if(sync() != 0){
+    printf(1, "sync failed\n");
+    exit();
+  }
+
+  fd = open("syncfile", O_RDONLY);
+  for(i = 0; i < 4; i++){
+    if(read(fd, buf, BSIZE) != BSIZE || buf[0] != 'a'+i || buf[BSIZE-1] != 'a'+i){
+      printf(1, "read syncfile wrong data\n");
+      exit();
+    }
+  }
+  close(fd);
+  unlink("syncfile");
+  printf(1, "sync test ok\n");
+}
+
 void
 uio()
 {
@@ -1792,9 +2471,19 @@ main(int argc, char *argv[])
   unlinkread();
   dirfile();
   iref();
+  manyinodes();
+  dcachetest();
+  hashdirtest();
+  getdentstest();
+  inlinetest();
+  manyfds();
+  preadtest();
+  iovtest();
+  mmaptest();
   forktest();
   bigdir(); // slow
 
+  synctest();
   uio();
 
   exectest();
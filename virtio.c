@@ -0,0 +1,348 @@
+// Virtio block device driver, for the file system disk when
+// QEMU provides one (make VIRTIO=1).
+//
+// Unlike the IDE disk, which runs one command at a time, the
+// device takes as many requests at once as there are
+// descriptors in its queue.  Requests that do not fit wait in
+// an I/O scheduler queue (iosched.c), where requests for
+// consecutive blocks are merged into one command.
+//
+// The device interrupts after the next completion while a
+// process is waiting for one of its requests; otherwise only
+// once everything in flight has completed, so that a burst of
+// asynchronous writes costs a single interrupt.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "iosched.h"
+#include "iostat.h"
+#include "virtio.h"
+
+#define SECTOR_SIZE   512
+#define QMAX          256  // largest queue the driver can use
+#define MAXSEG        32   // most blocks in one command
+
+// Request header and status byte for each descriptor chain,
+// indexed by the chain's first descriptor.
+struct vreq {
+  struct vblkreq hdr;
+  uchar status;
+  struct buf *b;       // bufs in the command, linked by qnext
+};
+
+static struct spinlock vlock;
+static struct ioq vqueue;      // requests waiting for descriptors
+static ushort iobase;          // 0 if there is no device
+static int irq;
+static int eventidx;           // interrupt suppression negotiated
+static uint capacity;          // sectors
+static int qsize;
+static struct vdesc *desc;
+static struct vavail *avail;
+static struct vused *used;
+static ushort *usedevent;      // interrupt when used->idx passes this
+static ushort *availevent;     // notify when avail->idx passes this
+static int freehead;           // free descriptors, linked by next
+static int nfree;
+static ushort lastused;        // used ring entries retired
+static int ninflight;          // commands in the device
+static int nsync;              // bufs in the device with a process waiting
+static uint ncmd;              // commands started
+static uint nblk;              // blocks they transferred
+static struct vreq req[QMAX];
+static char ring[3*PGSIZE] __attribute__((aligned(PGSIZE)));
+
+void
+virtioinit(void)
+{
+  struct pcidev *d;
+  uint feat;
+  ushort base;
+  int i, usedoff;
+
+  d = pcifind(-1, 0, VIRTIO_VENDOR, VIRTIO_DEV_BLK);
+  if(d == 0 || (d->iobar & 1) == 0 || d->irq == 0 || d->irq >= 24)
+    return;
+  initlock(&vlock, "virtio");
+  pciwrite(d, PCI_CMD, pciread(d, PCI_CMD) | PCI_CMD_IO | PCI_CMD_MASTER);
+  base = d->bar[0];
+
+  outb(base+VIRTIO_STATUS, 0);  // reset
+  outb(base+VIRTIO_STATUS, VIRTIO_S_ACK);
+  outb(base+VIRTIO_STATUS, VIRTIO_S_ACK|VIRTIO_S_DRIVER);
+  feat = inl(base+VIRTIO_HOSTFEAT) & VIRTIO_F_EVENTIDX;
+  outl(base+VIRTIO_GUESTFEAT, feat);
+  eventidx = feat != 0;
+
+  outw(base+VIRTIO_QSEL, 0);
+  qsize = inw(base+VIRTIO_QSIZE);
+  if(qsize == 0 || qsize > QMAX){
+    cprintf("virtio: queue size %d not supported\n", qsize);
+    outb(base+VIRTIO_STATUS, 0);
+    return;
+  }
+  desc = (struct vdesc*)ring;
+  avail = (struct vavail*)(ring + qsize*sizeof(struct vdesc));
+  usedevent = &avail->ring[qsize];
+  usedoff = PGROUNDUP(qsize*sizeof(struct vdesc) + (3+qsize)*sizeof(ushort));
+  used = (struct vused*)(ring + usedoff);
+  availevent = (ushort*)&used->ring[qsize];
+  for(i = 0; i < qsize; i++)
+    desc[i].next = i+1;
+  freehead = 0;
+  nfree = qsize;
+  outl(base+VIRTIO_QADDR, V2P(ring) / PGSIZE);
+
+  capacity = inl(base+VIRTIO_CAPACITY);
+  if(inl(base+VIRTIO_CAPACITY+4) != 0)
+    capacity = 0xffffffff;
+  outb(base+VIRTIO_STATUS, VIRTIO_S_ACK|VIRTIO_S_DRIVER|VIRTIO_S_OK);
+
+  irq = d->irq;
+  iobase = base;
+  ioapicenablepci(irq, ncpu - 1);
+}
+
+// Is the given device on virtio?
+int
+virtiodisk(uint dev)
+{
+  return iobase != 0 && dev == ROOTDEV;
+}
+
+static int
+dalloc(void)
+{
+  int i;
+
+  i = freehead;
+  freehead = desc[i].next;
+  nfree--;
+  return i;
+}
+
+// Free the descriptor chain starting at i.
+static void
+dfree(int i)
+{
+  int next;
+
+  for(;;){
+    next = desc[i].next;
+    desc[i].next = freehead;
+    freehead = i;
+    nfree++;
+    if((desc[i].flags & VDESC_NEXT) == 0)
+      break;
+    i = next;
+  }
+}
+
+// Append a descriptor for len bytes at va to the chain ending
+// at descriptor prev, and return it.
+static int
+dappend(int prev, void *va, uint len, int flags)
+{
+  int i;
+
+  i = dalloc();
+  desc[prev].next = i;
+  desc[prev].flags |= VDESC_NEXT;
+  desc[i].addr = V2P(va);
+  desc[i].addrhi = 0;
+  desc[i].len = len;
+  desc[i].flags = flags;
+  return i;
+}
+
+// Give queued requests to the device while there are
+// descriptors for them: a header, one per block, and a status.
+// Caller must hold vlock.
+static void
+vstart(void)
+{
+  struct buf *b, *q;
+  struct vreq *r;
+  int head, d, n, flags;
+  ushort old;
+
+  old = avail->idx;
+  while(nfree >= 3 && (b = ioqnext(&vqueue, 0)) != 0){
+    head = dalloc();
+    r = &req[head];
+    r->hdr.type = (b->flags & B_DIRTY) ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    r->hdr.reserved = 0;
+    r->hdr.sector = b->blockno * (BSIZE/SECTOR_SIZE);
+    r->hdr.sectorhi = 0;
+    r->status = 0xff;
+    r->b = b;
+    desc[head].addr = V2P(&r->hdr);
+    desc[head].addrhi = 0;
+    desc[head].len = sizeof(r->hdr);
+    desc[head].flags = 0;
+
+    flags = (b->flags & B_DIRTY) ? 0 : VDESC_WRITE;
+    d = head;
+    n = 0;
+    for(q = b; ; q = q->qnext){
+      d = dappend(d, q->data, BSIZE, flags);
+      if((q->flags & B_ASYNC) == 0)
+        nsync++;
+      n++;
+      q->qnext = 0;
+      if(n == MAXSEG || nfree < 2 || (q->qnext = ioqnext(&vqueue, q)) == 0)
+        break;
+    }
+    dappend(d, &r->status, 1, VDESC_WRITE);
+
+    avail->ring[avail->idx % qsize] = head;
+    __sync_synchronize();
+    avail->idx++;
+    ninflight++;
+    ncmd++;
+    nblk += n;
+  }
+  if(avail->idx == old)
+    return;
+
+  __sync_synchronize();
+  if(eventidx){
+    if((ushort)(avail->idx - *availevent - 1) < (ushort)(avail->idx - old))
+      outw(iobase+VIRTIO_QNOTIFY, 0);
+  } else if((used->flags & VUSED_NO_NOTIFY) == 0)
+    outw(iobase+VIRTIO_QNOTIFY, 0);
+}
+
+// Retire the commands the device has finished and start
+// queued requests in their place.  Return the finished
+// asynchronous bufs, linked by qnext, for the caller to
+// pass to biodone after releasing vlock.
+static struct buf*
+vcomplete(void)
+{
+  struct buf *b, *next, *done;
+  struct vreq *r;
+  int head;
+
+  done = 0;
+  for(;;){
+    while(lastused != used->idx){
+      __sync_synchronize();
+      head = used->ring[lastused % qsize].id;
+      lastused++;
+      r = &req[head];
+      if(r->status != 0)
+        panic("virtio: disk error");
+      for(b = r->b; b; b = next){
+        next = b->qnext;
+        b->flags |= B_VALID;
+        b->flags &= ~B_DIRTY;
+        ioqdone(&vqueue, b);
+        if(b->flags & B_ASYNC){
+          b->qnext = done;
+          done = b;
+        } else {
+          nsync--;
+          wakeup(b);
+        }
+      }
+      dfree(head);
+      ninflight--;
+    }
+    vstart();
+
+    // Choose the next interrupt.  If the device finished more
+    // meanwhile, it may already have passed that point.
+    if(!eventidx || ninflight == 0)
+      break;
+    *usedevent = lastused + (nsync ? 0 : ninflight-1);
+    __sync_synchronize();
+    if(used->idx == lastused)
+      break;
+  }
+  return done;
+}
+
+static void
+vfinish(struct buf *done)
+{
+  struct buf *b;
+
+  while((b = done) != 0){
+    done = b->qnext;
+    biodone(b);
+  }
+}
+
+// Interrupt handler.  Return 0 if the interrupt
+// is not the device's.
+int
+virtiointr(int n)
+{
+  struct buf *done;
+
+  if(iobase == 0 || n != irq)
+    return 0;
+  acquire(&vlock);
+  // Reading ISR acknowledges the interrupt and deasserts the
+  // level-triggered line, which would otherwise fire again.
+  inb(iobase+VIRTIO_ISR);
+  done = vcomplete();
+  release(&vlock);
+  vfinish(done);
+  return 1;
+}
+
+// Sync buf with disk, as iderw does.
+void
+virtiorw(struct buf *b)
+{
+  struct buf *done;
+  int async;
+
+  if(!holdingsleep(&b->lock))
+    panic("virtiorw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("virtiorw: nothing to do");
+  if(b->blockno >= capacity / (BSIZE/SECTOR_SIZE))
+    panic("virtiorw: block out of range");
+
+  async = b->flags & B_ASYNC;
+  acquire(&vlock);
+  ioqinsert(&vqueue, b);
+  done = vcomplete();
+  release(&vlock);
+  vfinish(done);
+
+  // Wait for request to finish.
+  if(!async){
+    acquire(&vlock);
+    while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+      sleep(b, &vlock);
+    release(&vlock);
+  }
+}
+
+// Report disk statistics.
+void
+virtiostat(struct iostat *st)
+{
+  if(iobase == 0)
+    return;
+  acquire(&vlock);
+  st->dcmds += ncmd;
+  st->dblocks += nblk;
+  ioqstat(&vqueue, st);
+  release(&vlock);
+}
@@ -0,0 +1,66 @@
+// Virtio block device, legacy PCI interface.
+
+#define VIRTIO_VENDOR     0x1af4
+#define VIRTIO_DEV_BLK    0x1001
+
+// Registers, at I/O BAR 0.
+#define VIRTIO_HOSTFEAT   0x00  // features offered by the device
+#define VIRTIO_GUESTFEAT  0x04  // features used by the driver
+#define VIRTIO_QADDR      0x08  // physical page number of the queue
+#define VIRTIO_QSIZE      0x0c  // entries in the queue (16 bits)
+#define VIRTIO_QSEL       0x0e  // queue to configure (16 bits)
+#define VIRTIO_QNOTIFY    0x10  // new requests in queue (16 bits)
+#define VIRTIO_STATUS     0x12  // device status (8 bits)
+#define VIRTIO_ISR        0x13  // interrupt status; reading clears it
+#define VIRTIO_CAPACITY   0x14  // disk size in sectors (64 bits)
+
+// Device status bits.
+#define VIRTIO_S_ACK      1
+#define VIRTIO_S_DRIVER   2
+#define VIRTIO_S_OK       4
+
+// Feature bits.
+#define VIRTIO_F_EVENTIDX (1<<29)  // used_event and avail_event
+
+// A queue, or ring: a table of descriptors, the avail ring in
+// which the driver gives descriptor chains to the device,
+// and, on the next page boundary, the used ring in which the
+// device returns them.
+struct vdesc {
+  uint addr;
+  uint addrhi;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+#define VDESC_NEXT        1  // next is valid
+#define VDESC_WRITE       2  // device writes the buffer
+
+struct vavail {
+  ushort flags;
+  ushort idx;      // where the driver puts the next entry
+  ushort ring[];   // followed by used_event
+};
+
+struct vusedelem {
+  uint id;         // head of the descriptor chain
+  uint len;
+};
+
+struct vused {
+  ushort flags;
+  ushort idx;      // where the device puts the next entry
+  struct vusedelem ring[];  // followed by avail_event
+};
+#define VUSED_NO_NOTIFY   1
+
+// A block request: this header, the data buffers, and a
+// status byte written by the device.
+struct vblkreq {
+  uint type;
+  uint reserved;
+  uint sector;
+  uint sectorhi;
+};
+#define VIRTIO_BLK_T_IN   0
+#define VIRTIO_BLK_T_OUT  1